@@ -1,9 +1,341 @@
 #include "./GFinalCustom.h"
+#include "./include/GMath.h"
 
+#include <algorithm>
 #include <cmath>
 
+// Voronoi shader
+
+namespace {
+
+// Queries further than this many cells from the grid are pulled in to this distance
+constexpr float kFarCells = 1 << 20;
+
+// floor(v), pinned to [lo, hi]
+inline int floor_to_cell(float v, int lo, int hi) {
+    return (int)std::floor(std::clamp(v, (float)lo, (float)hi));
+}
+
+}  // namespace
+
+GVoronoiShader::GVoronoiShader(const GPoint points[], const GColor colors[], int count)
+    : fOpaque(true), fOrigin{0, 0}, fCellSize(1), fInvCellSize(1), fGridW(1), fGridH(1) {
+    std::vector<int> sites;
+    float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+    for (int i = 0; i < count; ++i) {
+        const GPoint p = points[i];
+        if (std::isfinite(p.x) && std::isfinite(p.y)) {
+            sites.push_back(i);
+            minX = std::min(minX, p.x);
+            minY = std::min(minY, p.y);
+            maxX = std::max(maxX, p.x);
+            maxY = std::max(maxY, p.y);
+        }
+    }
+    const int n = (int)sites.size();
+
+    // Square cells holding about two sites each, but no more than n cells along either side
+    // when the sites are (nearly) on a line
+    const float w = maxX - minX, h = maxY - minY;
+    float cell = std::max(std::sqrt(2 * w * h / n), std::max(w, h) / n);
+    if (!(cell > 0) || !std::isfinite(cell)) {
+        cell = std::max(w, h) > 0 ? INFINITY : 1;
+    }
+    fOrigin = {minX, minY};
+    fCellSize = cell;
+    fInvCellSize = 1 / cell;
+    fGridW = std::isfinite(cell) ? (int)(w * fInvCellSize) + 1 : 1;
+    fGridH = std::isfinite(cell) ? (int)(h * fInvCellSize) + 1 : 1;
+
+    // Counting sort of the sites by cell
+    std::vector<int> cellOf(n);
+    fCellStart.assign(fGridW * fGridH + 1, 0);
+    for (int k = 0; k < n; ++k) {
+        const GPoint p = points[sites[k]];
+        const int cx = std::min((int)((p.x - minX) * fInvCellSize), fGridW - 1);
+        const int cy = std::min((int)((p.y - minY) * fInvCellSize), fGridH - 1);
+        cellOf[k] = cy * fGridW + cx;
+        fCellStart[cellOf[k] + 1] += 1;
+    }
+    for (int c = 0; c < fGridW * fGridH; ++c) {
+        fCellStart[c + 1] += fCellStart[c];
+    }
+
+    fPoints.resize(n);
+    fColors.resize(n);
+    fPixels.resize(n);
+    std::vector<int> next(fCellStart.begin(), fCellStart.end() - 1);
+    for (int k = 0; k < n; ++k) {
+        const int dst = next[cellOf[k]]++;
+        fPoints[dst] = points[sites[k]];
+        fColors[dst] = colors[sites[k]];
+        fPixels[dst] = GColorToPixel(colors[sites[k]]);
+        fOpaque &= colors[sites[k]].a >= 1.0f;
+    }
+}
+
+int GVoronoiShader::nearest(GPoint p, int candidate) const {
+    auto dist2 = [&](int i) {
+        const float dx = fPoints[i].x - p.x, dy = fPoints[i].y - p.y;
+        return dx * dx + dy * dy;
+    };
+    int best = candidate;
+    float bestDist2 = dist2(best);
+    if (!std::isfinite(bestDist2)) {
+        return best;
+    }
+    // Squared distance, in cells, within which a closer site has to be
+    const float invCell2 = fInvCellSize * fInvCellSize;
+    float reach2 = bestDist2 * invCell2;
+
+    // p in grid units. Pulling a far away p in towards the grid only brings it closer to every
+    // cell, so the distance bounds below stay conservative, and the cell indices can't overflow.
+    const float gx = std::clamp((p.x - fOrigin.x) * fInvCellSize, -kFarCells, fGridW + kFarCells);
+    const float gy = std::clamp((p.y - fOrigin.y) * fInvCellSize, -kFarCells, fGridH + kFarCells);
+    const int cx = (int)std::floor(gx), cy = (int)std::floor(gy);
+
+    auto scanCell = [&](int x, int y) {
+        const int c = y * fGridW + x;
+        for (int i = fCellStart[c]; i < fCellStart[c + 1]; ++i) {
+            const float d = dist2(i);
+            if (d < bestDist2) {
+                bestDist2 = d;
+                reach2 = d * invCell2;
+                best = i;
+            }
+        }
+    };
+    // The cells of column x between rows y0 and y1 that are within reach
+    auto scanColumn = [&](int x, int y0, int y1) {
+        const float dx = std::max(x - gx, gx - (x + 1));
+        const float rest = reach2 - dx * dx;
+        if (x < 0 || x >= fGridW || rest <= 0) {
+            return;
+        }
+        const float half = std::sqrt(rest);
+        y0 = std::max(y0, floor_to_cell(gy - half, 0, fGridH));
+        y1 = std::min(y1, floor_to_cell(gy + half, -1, fGridH - 1));
+        for (int y = y0; y <= y1; ++y) {
+            scanCell(x, y);
+        }
+    };
+    auto scanRow = [&](int y, int x0, int x1) {
+        const float dy = std::max(y - gy, gy - (y + 1));
+        const float rest = reach2 - dy * dy;
+        if (y < 0 || y >= fGridH || rest <= 0) {
+            return;
+        }
+        const float half = std::sqrt(rest);
+        x0 = std::max(x0, floor_to_cell(gx - half, 0, fGridW));
+        x1 = std::min(x1, floor_to_cell(gx + half, -1, fGridW - 1));
+        for (int x = x0; x <= x1; ++x) {
+            scanCell(x, y);
+        }
+    };
+
+    // Visit the rings of cells around p's cell, nearest first, until the next ring is out of
+    // reach. Every cell of ring r is at least edge + r - 1 cells away. Rings that miss the grid
+    // entirely (p is outside it) are skipped.
+    const float edge = std::min(std::min(gx - cx, cx + 1 - gx), std::min(gy - cy, cy + 1 - gy));
+    const int rMin = std::max(std::max(-cx, cx - (fGridW - 1)), std::max(std::max(-cy, cy - (fGridH - 1)), 0));
+    const int rMax = std::max(std::max(cx, fGridW - 1 - cx), std::max(cy, fGridH - 1 - cy));
+    for (int r = rMin; r <= rMax; ++r) {
+        if (r == 0) {
+            scanCell(cx, cy);
+            continue;
+        }
+        const float bound = edge + (r - 1);
+        if (bound * bound >= reach2) {
+            break;
+        }
+        scanRow(cy - r, cx - r, cx + r);
+        scanRow(cy + r, cx - r, cx + r);
+        scanColumn(cx - r, cy - r + 1, cy + r - 1);
+        scanColumn(cx + r, cy - r + 1, cy + r - 1);
+    }
+    return best;
+}
+
+class GVoronoiShader::Context : public GShaderContext {
+public:
+    Context(const GVoronoiShader& shader, const GMatrix& inverse)
+        : fShader(shader), fInverse(inverse) {}
+
+    void shadeRow(int x, int y, int count, GPixel row[]) override {
+        const GMatrix& m = fInverse;
+        const float p0x = m[0] * (x + 0.5f) + m[2] * (y + 0.5f) + m[4];
+        const float p0y = m[1] * (x + 0.5f) + m[3] * (y + 0.5f) + m[5];
+        const float dx = m[0], dy = m[1];
+
+        // Neighbouring pixels usually share a site, so each search starts from the previous
+        // pixel's winner. A span starts from the winner at the start of the span before it,
+        // which is usually just above.
+        int winner = fSpanWinner;
+        for (int i = 0; i < count; ++i) {
+            winner = fShader.nearest({p0x + i * dx, p0y + i * dy}, winner);
+            if (i == 0) {
+                fSpanWinner = winner;
+            }
+            row[i] = fShader.fPixels[winner];
+        }
+    }
+
+private:
+    const GVoronoiShader& fShader;
+    GMatrix fInverse;
+    int fSpanWinner = 0;
+};
+
+GShaderContext* GVoronoiShader::makeContext(const GMatrix& ctm, Arena& arena) const {
+    auto inv = ctm.invert();
+    if (!inv) {
+        return nullptr;
+    }
+    return arena.make<Context>(*this, *inv);
+}
+
 std::shared_ptr<GShader> GFinalCustom::createVoronoiShader(const GPoint points[], const GColor colors[], int count) {
-    return nullptr;  
+    auto finite = [](GPoint p) { return std::isfinite(p.x) && std::isfinite(p.y); };
+    if (count <= 0 || std::none_of(points, points + count, finite)) {
+        return nullptr;
+    }
+    return std::make_shared<GVoronoiShader>(points, colors, count);
+}
+
+// Sweep gradient
+
+// atan2(y, x) / 2pi in [0, 1], from a polynomial for atan on [0, 1] that is within 3e-5 turns
+// (well under one color step of the LUT), folded into the other octants
+namespace {
+
+constexpr float kAtanC0 = 0.15912117f;
+constexpr float kAtanC1 = -5.1853970e-2f;
+constexpr float kAtanC2 = 2.4761019e-2f;
+constexpr float kAtanC3 = -7.0583463e-3f;
+
+inline float sweep_turns(float x, float y) {
+    const float ax = std::fabs(x), ay = std::fabs(y);
+    // The tiny bias keeps the center (0, 0) from dividing by zero
+    const float a = std::min(ax, ay) / (std::max(ax, ay) + 1e-30f);
+    const float s = a * a;
+    float r = a * (kAtanC0 + s * (kAtanC1 + s * (kAtanC2 + s * kAtanC3)));
+    if (ay > ax) r = 0.25f - r;
+    if (x < 0) r = 0.5f - r;
+    if (y < 0) r = 1 - r;
+    return r;
+}
+
+#if defined(__SSE2__)
+inline __m128 vset(float v, __m128) { return _mm_set1_ps(v); }
+inline __m128 vabs(__m128 v) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), v); }
+inline __m128 vmin(__m128 a, __m128 b) { return _mm_min_ps(a, b); }
+inline __m128 vmax(__m128 a, __m128 b) { return _mm_max_ps(a, b); }
+inline __m128 vadd(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+inline __m128 vsub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+inline __m128 vmul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+inline __m128 vdiv(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+inline __m128 vlt(__m128 a, __m128 b) { return _mm_cmplt_ps(a, b); }
+inline __m128 vselect(__m128 m, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+#endif
+
+#if defined(__AVX2__)
+inline __m256 vset(float v, __m256) { return _mm256_set1_ps(v); }
+inline __m256 vabs(__m256 v) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v); }
+inline __m256 vmin(__m256 a, __m256 b) { return _mm256_min_ps(a, b); }
+inline __m256 vmax(__m256 a, __m256 b) { return _mm256_max_ps(a, b); }
+inline __m256 vadd(__m256 a, __m256 b) { return _mm256_add_ps(a, b); }
+inline __m256 vsub(__m256 a, __m256 b) { return _mm256_sub_ps(a, b); }
+inline __m256 vmul(__m256 a, __m256 b) { return _mm256_mul_ps(a, b); }
+inline __m256 vdiv(__m256 a, __m256 b) { return _mm256_div_ps(a, b); }
+inline __m256 vlt(__m256 a, __m256 b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline __m256 vselect(__m256 m, __m256 a, __m256 b) { return _mm256_blendv_ps(b, a, m); }
+#endif
+
+// sweep_turns() on each lane
+template <typename V> inline V sweep_turns(V x, V y) {
+    const V ax = vabs(x), ay = vabs(y);
+    const V a = vdiv(vmin(ax, ay), vadd(vmax(ax, ay), vset(1e-30f, x)));
+    const V s = vmul(a, a);
+    V r = vadd(vmul(s, vset(kAtanC3, x)), vset(kAtanC2, x));
+    r = vadd(vmul(s, r), vset(kAtanC1, x));
+    r = vadd(vmul(s, r), vset(kAtanC0, x));
+    r = vmul(a, r);
+    r = vselect(vlt(ax, ay), vsub(vset(0.25f, x), r), r);
+    r = vselect(vlt(x, vset(0, x)), vsub(vset(0.5f, x), r), r);
+    r = vselect(vlt(y, vset(0, x)), vsub(vset(1, x), r), r);
+    return r;
+}
+
+}  // namespace
+
+class GSweepGradientShader::Context : public GShaderContext {
+public:
+    Context(const GradientLUT& lut, const GMatrix& inverse, float startTurns)
+        : fLUT(lut), fInverse(inverse), fStartTurns(startTurns) {}
+
+    void shadeRow(int x, int y, int count, GPixel row[]) override {
+        // The pixel centers map to p0 + i * d relative to the sweep's center
+        const GMatrix& m = fInverse;
+        const float p0x = m[0] * (x + 0.5f) + m[2] * (y + 0.5f) + m[4];
+        const float p0y = m[1] * (x + 0.5f) + m[3] * (y + 0.5f) + m[5];
+        const float dx = m[0], dy = m[1];
+
+        int i = 0;
+#if defined(__AVX2__)
+        const __m256 lanes8 = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+        for (; i + 8 <= count; i += 8) {
+            const __m256 n = _mm256_add_ps(_mm256_set1_ps((float)i), lanes8);
+            const __m256 px = _mm256_add_ps(_mm256_set1_ps(p0x), _mm256_mul_ps(n, _mm256_set1_ps(dx)));
+            const __m256 py = _mm256_add_ps(_mm256_set1_ps(p0y), _mm256_mul_ps(n, _mm256_set1_ps(dy)));
+            alignas(32) float t[8];
+            _mm256_store_ps(t, this->wrap(sweep_turns(px, py)));
+            for (int k = 0; k < 8; ++k) {
+                row[i + k] = fLUT.lookup(t[k]);
+            }
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128 lanes4 = _mm_setr_ps(0, 1, 2, 3);
+        for (; i + 4 <= count; i += 4) {
+            const __m128 n = _mm_add_ps(_mm_set1_ps((float)i), lanes4);
+            const __m128 px = _mm_add_ps(_mm_set1_ps(p0x), _mm_mul_ps(n, _mm_set1_ps(dx)));
+            const __m128 py = _mm_add_ps(_mm_set1_ps(p0y), _mm_mul_ps(n, _mm_set1_ps(dy)));
+            alignas(16) float t[4];
+            _mm_store_ps(t, this->wrap(sweep_turns(px, py)));
+            for (int k = 0; k < 4; ++k) {
+                row[i + k] = fLUT.lookup(t[k]);
+            }
+        }
+#endif
+        for (; i < count; ++i) {
+            float t = sweep_turns(p0x + i * dx, p0y + i * dy) - fStartTurns;
+            row[i] = fLUT.lookup(t < 0 ? t + 1 : t);
+        }
+    }
+
+private:
+    // Turns past the start angle, in [0, 1]
+    template <typename V> V wrap(V turns) const {
+        const V t = vsub(turns, vset(fStartTurns, turns));
+        return vselect(vlt(t, vset(0, t)), vadd(t, vset(1, t)), t);
+    }
+
+    const GradientLUT& fLUT;
+    GMatrix fInverse;   // Device to local space, relative to the center
+    float fStartTurns;  // Start angle in turns, in [0, 1)
+};
+
+GShaderContext* GSweepGradientShader::makeContext(const GMatrix& ctm, Arena& arena) const {
+    auto inv = ctm.invert();
+    if (!inv) {
+        return nullptr;
+    }
+    const GMatrix inverse = GMatrix::Concat(GMatrix::Translate(-fCenter.x, -fCenter.y), *inv);
+    float startTurns = fStartRadians / (2 * gFloatPI);
+    startTurns -= std::floor(startTurns);
+    return arena.make<Context>(fLUT, inverse, startTurns);
 }
 
 std::shared_ptr<GShader> GFinalCustom::createSweepGradient(GPoint center, float startRadians, const GColor colors[], int count) {
@@ -18,7 +350,198 @@ std::shared_ptr<GShader> GFinalCustom::createLinearPosGradient(GPoint p0, GPoint
     return std::make_shared<GLinearPosGradientShader>(p0, p1, colors, pos, count);
 }
 
+// Color matrix shader
+
+namespace {
+
+// 1/a for every 8-bit alpha (and 0 for 0), so unpremultiplying doesn't divide
+struct UnpremulTable {
+    float inv[256] = {};
+    constexpr UnpremulTable() {
+        for (int a = 1; a < 256; ++a) {
+            inv[a] = 1.0f / a;
+        }
+    }
+};
+constexpr UnpremulTable gUnpremul;
+
+// Scalar versions of the vector helpers above, so one kernel also handles leftover pixels
+inline float vset(float v, float) { return v; }
+inline float vmin(float a, float b) { return std::min(a, b); }
+inline float vmax(float a, float b) { return std::max(a, b); }
+inline float vadd(float a, float b) { return a + b; }
+inline float vmul(float a, float b) { return a * b; }
+
+// Loading splits 1, 4 or 8 pixels into channels in [0, 255], one pixel per lane. Storing
+// rounds the channels (which must already be in [0, 255]) and packs them back.
+inline void load_pixels(const GPixel p[], float& a, float& r, float& g, float& b) {
+    a = (float)GPixel_GetA(*p);
+    r = (float)GPixel_GetR(*p);
+    g = (float)GPixel_GetG(*p);
+    b = (float)GPixel_GetB(*p);
+}
+inline float unpremul_scale(const GPixel p[], float) {
+    return gUnpremul.inv[GPixel_GetA(*p)];
+}
+inline void store_pixels(GPixel p[], float a, float r, float g, float b) {
+    *p = GPixel_PackARGB((int)(a + 0.5f), (int)(r + 0.5f), (int)(g + 0.5f), (int)(b + 0.5f));
+}
+
+#if defined(__SSE2__)
+inline void load_pixels(const GPixel p[], __m128& a, __m128& r, __m128& g, __m128& b) {
+    const __m128i px = _mm_loadu_si128((const __m128i*)p);
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    a = _mm_cvtepi32_ps(_mm_srli_epi32(px, GPIXEL_SHIFT_A));
+    r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, GPIXEL_SHIFT_R), mask));
+    g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, GPIXEL_SHIFT_G), mask));
+    b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(px, GPIXEL_SHIFT_B), mask));
+}
+inline __m128 unpremul_scale(const GPixel p[], __m128) {
+    return _mm_setr_ps(gUnpremul.inv[GPixel_GetA(p[0])], gUnpremul.inv[GPixel_GetA(p[1])],
+                       gUnpremul.inv[GPixel_GetA(p[2])], gUnpremul.inv[GPixel_GetA(p[3])]);
+}
+inline __m128i round_to_int(__m128 v) {
+    return _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+}
+inline void store_pixels(GPixel p[], __m128 a, __m128 r, __m128 g, __m128 b) {
+    const __m128i ar = _mm_or_si128(_mm_slli_epi32(round_to_int(a), GPIXEL_SHIFT_A),
+                                    _mm_slli_epi32(round_to_int(r), GPIXEL_SHIFT_R));
+    const __m128i gb = _mm_or_si128(_mm_slli_epi32(round_to_int(g), GPIXEL_SHIFT_G),
+                                    _mm_slli_epi32(round_to_int(b), GPIXEL_SHIFT_B));
+    _mm_storeu_si128((__m128i*)p, _mm_or_si128(ar, gb));
+}
+#endif
+
+#if defined(__AVX2__)
+inline void load_pixels(const GPixel p[], __m256& a, __m256& r, __m256& g, __m256& b) {
+    const __m256i px = _mm256_loadu_si256((const __m256i*)p);
+    const __m256i mask = _mm256_set1_epi32(0xFF);
+    a = _mm256_cvtepi32_ps(_mm256_srli_epi32(px, GPIXEL_SHIFT_A));
+    r = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, GPIXEL_SHIFT_R), mask));
+    g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, GPIXEL_SHIFT_G), mask));
+    b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(px, GPIXEL_SHIFT_B), mask));
+}
+inline __m256 unpremul_scale(const GPixel p[], __m256) {
+    const __m256i px = _mm256_loadu_si256((const __m256i*)p);
+    return _mm256_i32gather_ps(gUnpremul.inv, _mm256_srli_epi32(px, GPIXEL_SHIFT_A), 4);
+}
+inline __m256i round_to_int(__m256 v) {
+    return _mm256_cvttps_epi32(_mm256_add_ps(v, _mm256_set1_ps(0.5f)));
+}
+inline void store_pixels(GPixel p[], __m256 a, __m256 r, __m256 g, __m256 b) {
+    const __m256i ar = _mm256_or_si256(_mm256_slli_epi32(round_to_int(a), GPIXEL_SHIFT_A),
+                                       _mm256_slli_epi32(round_to_int(r), GPIXEL_SHIFT_R));
+    const __m256i gb = _mm256_or_si256(_mm256_slli_epi32(round_to_int(g), GPIXEL_SHIFT_G),
+                                       _mm256_slli_epi32(round_to_int(b), GPIXEL_SHIFT_B));
+    _mm256_storeu_si256((__m256i*)p, _mm256_or_si256(ar, gb));
+}
+#endif
+
+inline bool keeps_alpha(const GColorMatrix& m) {
+    return m[3] == 0 && m[7] == 0 && m[11] == 0 && m[15] == 1 && m[19] == 0;
+}
+
+// Row 0..3 of the column-major 4x5 matrix times (r, g, b, a, w)
+template <typename V> inline V dot(const float m[], int row, V r, V g, V b, V a, V w) {
+    V v = vmul(vset(m[16 + row], r), w);
+    v = vadd(v, vmul(vset(m[row], r), r));
+    v = vadd(v, vmul(vset(m[4 + row], r), g));
+    v = vadd(v, vmul(vset(m[8 + row], r), b));
+    return vadd(v, vmul(vset(m[12 + row], r), a));
+}
+
+// Applies the matrix to the pixels in the lanes of V, in place
+template <bool kAppliesToPremul, typename V> inline void apply_color_matrix(const float m[], GPixel p[]) {
+    V a, r, g, b;
+    load_pixels(p, a, r, g, b);
+    const V zero = vset(0, a);
+
+    if (kAppliesToPremul) {
+        // Scaling the translation by alpha premultiplies it. With alpha unchanged, clamping to
+        // [0, a] is clamping the unpremultiplied result to [0, 1].
+        const V r2 = vmin(vmax(dot(m, 0, r, g, b, zero, a), zero), a);
+        const V g2 = vmin(vmax(dot(m, 1, r, g, b, zero, a), zero), a);
+        const V b2 = vmin(vmax(dot(m, 2, r, g, b, zero, a), zero), a);
+        store_pixels(p, a, r2, g2, b2);
+        return;
+    }
+
+    // Unpremultiply to [0, 1]
+    const V scale = unpremul_scale(p, a);
+    r = vmul(r, scale);
+    g = vmul(g, scale);
+    b = vmul(b, scale);
+    a = vmul(a, vset(1 / 255.0f, a));
+
+    const V one = vset(1, a);
+    const V r2 = vmin(vmax(dot(m, 0, r, g, b, a, one), zero), one);
+    const V g2 = vmin(vmax(dot(m, 1, r, g, b, a, one), zero), one);
+    const V b2 = vmin(vmax(dot(m, 2, r, g, b, a, one), zero), one);
+    const V a2 = vmin(vmax(dot(m, 3, r, g, b, a, one), zero), one);
+
+    // Premultiply back to [0, 255]
+    const V a255 = vmul(a2, vset(255.0f, a));
+    store_pixels(p, a255, vmul(r2, a255), vmul(g2, a255), vmul(b2, a255));
+}
+
+template <bool kAppliesToPremul> void apply_color_matrix(const float m[], GPixel row[], int count) {
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8) {
+        apply_color_matrix<kAppliesToPremul, __m256>(m, row + i);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4) {
+        apply_color_matrix<kAppliesToPremul, __m128>(m, row + i);
+    }
+#endif
+    for (; i < count; ++i) {
+        apply_color_matrix<kAppliesToPremul, float>(m, row + i);
+    }
+}
+
+}  // namespace
+
+GColorMatrixShader::GColorMatrixShader(const GColorMatrix& matrix, GShader* realShader)
+    : fMatrix(matrix), fRealShader(realShader), fRealShaderRef(realShader->weak_from_this().lock()),
+      fKeepsAlpha(keeps_alpha(matrix)),
+      fAppliesToPremul(fKeepsAlpha && matrix[12] == 0 && matrix[13] == 0 && matrix[14] == 0) {}
+
+class GColorMatrixShader::Context : public GShaderContext {
+public:
+    Context(const GColorMatrixShader& shader, GShaderContext* realContext)
+        : fShader(shader), fRealContext(realContext) {}
+
+    void shadeRow(int x, int y, int count, GPixel row[]) override {
+        // Transform the real shader's pixels in place
+        fRealContext->shadeRow(x, y, count, row);
+
+        const float* m = fShader.fMatrix.fMat.data();
+        if (fShader.fAppliesToPremul) {
+            apply_color_matrix<true>(m, row, count);
+        } else {
+            apply_color_matrix<false>(m, row, count);
+        }
+    }
+
+private:
+    const GColorMatrixShader& fShader;
+    GShaderContext* fRealContext;
+};
+
+GShaderContext* GColorMatrixShader::makeContext(const GMatrix& ctm, Arena& arena) const {
+    GShaderContext* realContext = fRealShader->makeContext(ctm, arena);
+    if (!realContext) {
+        return nullptr;
+    }
+    return arena.make<Context>(*this, realContext);
+}
+
 std::shared_ptr<GShader> GFinalCustom::createColorMatrixShader(const GColorMatrix& matrix, GShader* realShader) {
+    if (!realShader) {
+        return nullptr;
+    }
     return std::make_shared<GColorMatrixShader>(matrix, realShader);
 }
 
@@ -9,6 +9,9 @@
 #include "./include/GPoint.h"
 #include "./include/GMatrix.h"
 #include "./my_utils.h"
+#include "./arena.h"
+#include "./gradient_lut.h"
+#include <cmath>
 #include <memory>
 #include <vector>
 
@@ -32,47 +35,67 @@ public:
 std::unique_ptr<GFinal> GCreateFinal();
 
 
-class GSweepGradientShader : public GShader {
+class GVoronoiShader : public GShader {
 public:
-    GSweepGradientShader(GPoint center, float startRadians, const GColor* colors, int count)
-        : fCenter(center), fStartRadians(startRadians), fColors(colors), fCount(count) {}
+    // Copies the sites, dropping any with non-finite coordinates. At least one must be finite.
+    GVoronoiShader(const GPoint points[], const GColor colors[], int count);
 
-    bool isOpaque() override {
-        return false;
+    bool isOpaque() const override {
+        return fOpaque;
     }
 
-    bool setContext(const GMatrix& ctm) override {
-        return true;
-    }
+    GShaderContext* makeContext(const GMatrix& ctm, Arena& arena) const override;
 
-    void shadeRow(int x, int y, int count, GPixel row[]) override {
-        for (int i = 0; i < count; ++i) {
-            float dx = x - fCenter.x;
-            float dy = y - fCenter.y;
-            float angle = std::atan2(dy, dx);
-            if (angle < 0) angle += static_cast<float>(2 * M_PI);
+private:
+    friend class PictureFile;
+    class Context;
 
-            float normalizedAngle = static_cast<float>((angle - fStartRadians) / (2 * M_PI));
-            if (normalizedAngle < 0) normalizedAngle += 1.0f;
-            int colorIndex = static_cast<int>(normalizedAngle * fCount);
-            colorIndex = (colorIndex == fCount) ? 0 : colorIndex;
+    // Index of the site closest to p, starting the search from the site candidate
+    int nearest(GPoint p, int candidate) const;
 
-            row[i] = GColorToPixel(fColors[colorIndex]);
-        }
+    // Sites sorted by grid cell, with their colors and premultiplied pixels
+    std::vector<GPoint> fPoints;
+    std::vector<GColor> fColors;
+    std::vector<GPixel> fPixels;
+    bool fOpaque;
+
+    // Uniform grid of square cells over the sites' bounds, about two sites per cell. The sites in
+    // cell (cx, cy) are [fCellStart[c], fCellStart[c + 1]) where c = cy * fGridW + cx.
+    GPoint fOrigin;
+    float fCellSize, fInvCellSize;
+    int fGridW, fGridH;
+    std::vector<int> fCellStart;
+};
+
+class GSweepGradientShader : public GShader {
+public:
+    GSweepGradientShader(GPoint center, float startRadians, const GColor* colors, int count)
+        : fCenter(center), fStartRadians(startRadians), fColors(colors, colors + count), fCount(count),
+          fLUT(colors, nullptr, count, GradientLUT::SizeFor(count, INFINITY)) {}
+
+    bool isOpaque() const override {
+        return fLUT.isOpaque();
     }
 
+    GShaderContext* makeContext(const GMatrix& ctm, Arena& arena) const override;
+
 private:
+    friend class PictureFile;
+    class Context;
+
     GPoint fCenter;
     float fStartRadians;
-    const GColor* fColors;
+    std::vector<GColor> fColors;  // Copied, since drawing may happen after the caller's array is gone
     int fCount;
+    GradientLUT fLUT;
 };
 
 class GLinearPosGradientShader : public GShader {
 public:
     GLinearPosGradientShader(GPoint p0, GPoint p1, const GColor colors[], const float pos[], int count)
-        : fP0(p0), fP1(p1), fCount(count) {
-        
+        : fP0(p0), fP1(p1), fCount(count),
+          fLUT(colors, pos, count, GradientLUT::SizeFor(count, std::fabs(p1.x - p0.x))) {
+
         fColors.reserve(count);
         fPos.reserve(count);
         for (int i = 0; i < count; ++i) {
@@ -81,101 +104,65 @@ public:
         }
     }
 
-    bool isOpaque() override {
-        for (const auto& color : fColors) {
-            if (color.a < 1.0f) return false;
-        }
-        return true;
+    bool isOpaque() const override {
+        return fLUT.isOpaque();
     }
 
-    bool setContext(const GMatrix& ctm) override {
-        return true;
+    GShaderContext* makeContext(const GMatrix& ctm, Arena& arena) const override {
+        return arena.make<Context>(*this);
     }
 
-    void shadeRow(int x, int y, int count, GPixel row[]) override {
-        for (int i = 0; i < count; ++i) {
-            float t = (x + i - fP0.x) / (fP1.x - fP0.x);
-            t = std::min(1.0f, std::max(0.0f, t));
-            
-            int lower = 0;
-            int upper = fCount - 1;
-            while (upper - lower > 1) {
-                int mid = (upper + lower) / 2;
-                if (fPos[mid] < t) {
-                    lower = mid;
-                } else {
-                    upper = mid;
-                }
+private:
+    friend class PictureFile;
+
+    class Context : public GShaderContext {
+    public:
+        Context(const GLinearPosGradientShader& shader) : fShader(shader) {}
+
+        void shadeRow(int x, int y, int count, GPixel row[]) override {
+            // t steps by a constant along the row; the lookup pins it
+            const GLinearPosGradientShader& s = fShader;
+            const float dt = 1 / (s.fP1.x - s.fP0.x);
+            const float t0 = (x - s.fP0.x) * dt;
+            for (int i = 0; i < count; ++i) {
+                row[i] = s.fLUT.lookup(t0 + i * dt);
             }
-            
-            float blend = (t - fPos[lower]) / (fPos[upper] - fPos[lower]);
-            GColor blendedColor = interpolate(fColors[lower], fColors[upper], blend);
-
-            row[i] = GColorToPixel(blendedColor);
         }
-    }
 
-private:
-    GColor interpolate(const GColor& c0, const GColor& c1, float t) {
-        return {
-            c0.r + t * (c1.r - c0.r),
-            c0.g + t * (c1.g - c0.g),
-            c0.b + t * (c1.b - c0.b),
-            c0.a + t * (c1.a - c0.a)
-        };
-    }
+    private:
+        const GLinearPosGradientShader& fShader;
+    };
 
     GPoint fP0, fP1;
     int fCount;
     std::vector<GColor> fColors;
     std::vector<float> fPos;
+    GradientLUT fLUT;
 };
 
 class GColorMatrixShader : public GShader {
 public:
-    GColorMatrixShader(const GColorMatrix& matrix, GShader* realShader)
-        : fMatrix(matrix), fRealShader(realShader) {}
-
-    bool isOpaque() override {
-        return false;
-    }
+    GColorMatrixShader(const GColorMatrix& matrix, GShader* realShader);
 
-    bool setContext(const GMatrix& ctm) override {
-        return fRealShader->setContext(ctm);
+    bool isOpaque() const override {
+        return fKeepsAlpha && fRealShader->isOpaque();
     }
 
-    void shadeRow(int x, int y, int count, GPixel row[]) override {
-        std::vector<GPixel> realRow(count);
-        fRealShader->shadeRow(x, y, count, realRow.data());
-
-        for (int i = 0; i < count; ++i) {
-            GColor color = GPixelToColor(realRow[i]);
-
-            float r = fMatrix[0] * color.r + fMatrix[4] * color.g + fMatrix[8] * color.b + fMatrix[12] * color.a + fMatrix[16];
-            float g = fMatrix[1] * color.r + fMatrix[5] * color.g + fMatrix[9] * color.b + fMatrix[13] * color.a + fMatrix[17];
-            float b = fMatrix[2] * color.r + fMatrix[6] * color.g + fMatrix[10] * color.b + fMatrix[14] * color.a + fMatrix[18];
-            float a = fMatrix[3] * color.r + fMatrix[7] * color.g + fMatrix[11] * color.b + fMatrix[15] * color.a + fMatrix[19];
-
-            r = std::clamp(r, 0.0f, 1.0f);
-            g = std::clamp(g, 0.0f, 1.0f);
-            b = std::clamp(b, 0.0f, 1.0f);
-            a = std::clamp(a, 0.0f, 1.0f);
-
-            row[i] = GColorToPixel({r, g, b, a});
-        }
-    }
+    GShaderContext* makeContext(const GMatrix& ctm, Arena& arena) const override;
 
 private:
+    friend class PictureFile;
+    class Context;
+
     GColorMatrix fMatrix;
     GShader* fRealShader;
+    std::shared_ptr<GShader> fRealShaderRef;  // Keeps realShader alive for deferred drawing, if it's shared
 
-    GColor GPixelToColor(GPixel pixel) {
-        float r = ((pixel >> 16) & 0xFF) / 255.0f;
-        float g = ((pixel >> 8) & 0xFF) / 255.0f;
-        float b = (pixel & 0xFF) / 255.0f;
-        float a = ((pixel >> 24) & 0xFF) / 255.0f;
-        return {r, g, b, a};
-    }
+    // The matrix passes alpha through unchanged
+    bool fKeepsAlpha;
+    // ... and its color rows don't read alpha, so it can be applied to premultiplied colors
+    // (with its translation scaled by alpha) without unpremultiplying them
+    bool fAppliesToPremul;
 };
 
 
@@ -0,0 +1,411 @@
+#include "GPicture.h"
+#include "./include/GPathBuilder.h"
+#include <algorithm>
+#include <cstring>
+
+// Each op is two header words, its type and its payload's length in words, followed by the
+// payload. Payloads are made only of 4-byte fields, so every field stays word aligned:
+//   kSave, kRestore  --
+//   kConcat          GMatrix
+//   kClear           GColor
+//   kDrawRect        paint, GRect
+//   kDrawPolygon     paint, count, GPoint[count]
+//   kDrawPath        paint, path
+//   kDrawMesh        paint, count, vertCount, flags, GPoint[vertCount],
+//                    [GColor[vertCount]], [GPoint[vertCount]], int[3 * count]
+//   kDrawQuad        paint, level, flags, GPoint[4], [GColor[4]], [GPoint[4]]
+// where paint and path are indices into fPaints and fPaths, and flags says which of the
+// optional colors/texs arrays follow.
+static constexpr size_t kOpHeaderWords = 2;
+
+enum {
+    kHasColors = 1 << 0,
+    kHasTexs   = 1 << 1,
+};
+
+static_assert(sizeof(GPoint) == 2 * sizeof(uint32_t), "GPoint must pack into words");
+static_assert(sizeof(GColor) == 4 * sizeof(uint32_t), "GColor must pack into words");
+static_assert(sizeof(GRect) == 4 * sizeof(uint32_t), "GRect must pack into words");
+static_assert(sizeof(GMatrix) == 6 * sizeof(uint32_t), "GMatrix must pack into words");
+
+// Copy count values of T into the word buffer, returning the word after them
+template <typename T> static uint32_t* write(uint32_t* dst, const T src[], int count) {
+    memcpy(dst, src, count * sizeof(T));
+    return dst + count * sizeof(T) / sizeof(uint32_t);
+}
+
+static uint32_t* write_int(uint32_t* dst, int value) {
+    *dst = (uint32_t)value;
+    return dst + 1;
+}
+
+// Point at count values of T in the word buffer, advancing past them
+template <typename T> static const T* read(const uint32_t*& src, int count) {
+    const T* values = reinterpret_cast<const T*>(src);
+    src += count * sizeof(T) / sizeof(uint32_t);
+    return values;
+}
+
+static int read_int(const uint32_t*& src) {
+    return (int)*src++;
+}
+
+// Copy a path that isn't owned by a shared_ptr, so the picture can keep it alive
+static std::shared_ptr<const GPath> copy_path(const GPath& path) {
+    GPathBuilder builder;
+    GPoint pts[GPath::kMaxNextPoints];
+    GPath::Iter iter(path);
+    while (auto v = iter.next(pts)) {
+        switch (*v) {
+            case kMove:  builder.moveTo(pts[0]); break;
+            case kLine:  builder.lineTo(pts[1]); break;
+            case kQuad:  builder.quadTo(pts[1], pts[2]); break;
+            case kCubic: builder.cubicTo(pts[1], pts[2], pts[3]); break;
+        }
+    }
+    return builder.detach();
+}
+
+bool GPicture::Iter::next(Op* op) {
+    if (fOffset >= fPicture.fOpWords) {
+        return false;
+    }
+    const uint32_t* src = fPicture.fOps + fOffset;
+    const uint32_t type = *src++;
+    fOffset += kOpHeaderWords + *src++;
+
+    *op = Op();
+    op->type = (OpType)type;
+    switch (op->type) {
+        case OpType::kSave:
+        case OpType::kRestore:
+            break;
+        case OpType::kConcat:
+            op->matrix = read<GMatrix>(src, 1);
+            break;
+        case OpType::kClear:
+            op->color = read<GColor>(src, 1);
+            break;
+        case OpType::kDrawRect:
+            op->paint = &fPicture.fPaints[read_int(src)];
+            op->rect = read<GRect>(src, 1);
+            break;
+        case OpType::kDrawPolygon:
+            op->paint = &fPicture.fPaints[read_int(src)];
+            op->count = op->vertCount = read_int(src);
+            op->points = read<GPoint>(src, op->vertCount);
+            break;
+        case OpType::kDrawPath:
+            op->paint = &fPicture.fPaints[read_int(src)];
+            op->path = fPicture.fPaths[read_int(src)].get();
+            break;
+        case OpType::kDrawMesh:
+        case OpType::kDrawQuad: {
+            op->paint = &fPicture.fPaints[read_int(src)];
+            op->count = read_int(src);
+            op->vertCount = op->type == OpType::kDrawMesh ? read_int(src) : 4;
+            const int flags = read_int(src);
+            op->points = read<GPoint>(src, op->vertCount);
+            if (flags & kHasColors) {
+                op->colors = read<GColor>(src, op->vertCount);
+            }
+            if (flags & kHasTexs) {
+                op->texs = read<GPoint>(src, op->vertCount);
+            }
+            if (op->type == OpType::kDrawMesh) {
+                op->indices = read<int>(src, op->count * 3);
+            }
+        } break;
+    }
+    return true;
+}
+
+bool GPicture::validate() const {
+    const int paintCount = (int)fPaints.size();
+    const int pathCount = (int)fPaths.size();
+    int opCount = 0;
+    for (size_t offset = 0; offset < fOpWords; ++opCount) {
+        if (fOpWords - offset < kOpHeaderWords) {
+            return false;
+        }
+        const uint32_t type = fOps[offset];
+        const size_t words = fOps[offset + 1];
+        const uint32_t* src = fOps + offset + kOpHeaderWords;
+        if (words > fOpWords - offset - kOpHeaderWords) {
+            return false;
+        }
+        offset += kOpHeaderWords + words;
+
+        // Leading fields, which say how long the rest of the payload is
+        auto field = [&](size_t i) { return i < words ? (int)src[i] : -1; };
+        size_t expected;
+        switch ((OpType)type) {
+            case OpType::kSave:
+            case OpType::kRestore:
+                expected = 0;
+                break;
+            case OpType::kConcat:
+                expected = sizeof(GMatrix);
+                break;
+            case OpType::kClear:
+                expected = sizeof(GColor);
+                break;
+            case OpType::kDrawRect:
+                expected = 4 + sizeof(GRect);
+                break;
+            case OpType::kDrawPolygon: {
+                const int count = field(1);
+                if (count < 3 || (size_t)count > words) {
+                    return false;
+                }
+                expected = 8 + count * sizeof(GPoint);
+            } break;
+            case OpType::kDrawPath:
+                if ((unsigned)field(1) >= (unsigned)pathCount) {
+                    return false;
+                }
+                expected = 8;
+                break;
+            case OpType::kDrawMesh: {
+                const int count = field(1), vertCount = field(2), flags = field(3);
+                if (count <= 0 || vertCount <= 0 || (size_t)count > words ||
+                    (size_t)vertCount > words || flags < 0) {
+                    return false;
+                }
+                expected = 16 + vertCount * sizeof(GPoint) + count * 3 * sizeof(int);
+                expected += (flags & kHasColors) ? vertCount * sizeof(GColor) : 0;
+                expected += (flags & kHasTexs) ? vertCount * sizeof(GPoint) : 0;
+                if (expected == words * sizeof(uint32_t)) {
+                    const int* indices = reinterpret_cast<const int*>(src + words) - count * 3;
+                    for (int i = 0; i < count * 3; ++i) {
+                        if ((unsigned)indices[i] >= (unsigned)vertCount) {
+                            return false;
+                        }
+                    }
+                }
+            } break;
+            case OpType::kDrawQuad: {
+                const int level = field(1), flags = field(2);
+                if (level < 0 || level > kMaxQuadLevel || flags < 0) {
+                    return false;
+                }
+                expected = 12 + 4 * sizeof(GPoint);
+                expected += (flags & kHasColors) ? 4 * sizeof(GColor) : 0;
+                expected += (flags & kHasTexs) ? 4 * sizeof(GPoint) : 0;
+            } break;
+            default:
+                return false;
+        }
+        if (expected != words * sizeof(uint32_t)) {
+            return false;
+        }
+        if (type >= (uint32_t)OpType::kDrawRect &&
+            (unsigned)field(0) >= (unsigned)paintCount) {
+            return false;
+        }
+    }
+    return opCount == fOpCount;
+}
+
+void GPicture::playback(GCanvas* canvas) const {
+    Iter iter(*this);
+    Op op;
+    while (iter.next(&op)) {
+        Draw(canvas, op);
+    }
+}
+
+void GPicture::Draw(GCanvas* canvas, const Op& op) {
+    switch (op.type) {
+        case OpType::kSave:
+            canvas->save();
+            break;
+        case OpType::kRestore:
+            canvas->restore();
+            break;
+        case OpType::kConcat:
+            canvas->concat(*op.matrix);
+            break;
+        case OpType::kClear:
+            canvas->clear(*op.color);
+            break;
+        case OpType::kDrawRect:
+            canvas->drawRect(*op.rect, *op.paint);
+            break;
+        case OpType::kDrawPolygon:
+            canvas->drawConvexPolygon(op.points, op.count, *op.paint);
+            break;
+        case OpType::kDrawPath:
+            canvas->drawPath(*op.path, *op.paint);
+            break;
+        case OpType::kDrawMesh:
+            canvas->drawMesh(op.points, op.colors, op.texs, op.count, op.indices, *op.paint);
+            break;
+        case OpType::kDrawQuad:
+            canvas->drawQuad(op.points, op.colors, op.texs, op.count, *op.paint);
+            break;
+    }
+}
+
+GRecordingCanvas::GRecordingCanvas() : fPicture(new GPicture) {}
+
+std::shared_ptr<const GPicture> GRecordingCanvas::finishRecording() {
+    fPicture->fOps = fPicture->fOpStorage.data();
+    fPicture->fOpWords = fPicture->fOpStorage.size();
+    std::shared_ptr<const GPicture> picture = std::move(fPicture);
+    fPicture.reset(new GPicture);
+    fPathIndices.clear();
+    return picture;
+}
+
+// Reserve room for an op and write its header, returning where its payload goes. Returns null,
+// recording nothing, if the payload is too long for its header (over 16GB).
+uint32_t* GRecordingCanvas::append(GPicture::OpType type, size_t payloadBytes) {
+    const size_t words = payloadBytes / sizeof(uint32_t);
+    if (words > UINT32_MAX) {
+        return nullptr;
+    }
+    std::vector<uint32_t>& ops = fPicture->fOpStorage;
+    const size_t offset = ops.size();
+    ops.resize(offset + kOpHeaderWords + words);
+    ops[offset] = (uint32_t)type;
+    ops[offset + 1] = (uint32_t)words;
+    fPicture->fOpCount += 1;
+    return ops.data() + offset + kOpHeaderWords;
+}
+
+// Consecutive draws usually share a paint, so only a repeat of the last one is deduplicated
+int GRecordingCanvas::addPaint(const GPaint& paint) {
+    std::vector<GPaint>& paints = fPicture->fPaints;
+    if (!paints.empty()) {
+        const GPaint& last = paints.back();
+        const GColor a = last.getColor(), b = paint.getColor();
+        if (a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a &&
+            last.getBlendMode() == paint.getBlendMode() &&
+            last.isAntiAlias() == paint.isAntiAlias() &&
+            last.peekShader() == paint.peekShader()) {
+            return (int)paints.size() - 1;
+        }
+    }
+    paints.push_back(paint);
+    return (int)paints.size() - 1;
+}
+
+// Shared paths are recorded once however often they are drawn. Other paths are copied on every
+// draw, since their address may be reused by a different path later on.
+int GRecordingCanvas::addPath(const GPath& path) {
+    std::vector<std::shared_ptr<const GPath>>& paths = fPicture->fPaths;
+    std::shared_ptr<const GPath> shared = path.weak_from_this().lock();
+    if (shared) {
+        auto found = fPathIndices.find(&path);
+        if (found != fPathIndices.end()) {
+            return found->second;
+        }
+        fPathIndices[&path] = (int)paths.size();
+    }
+    paths.push_back(shared ? std::move(shared) : copy_path(path));
+    return (int)paths.size() - 1;
+}
+
+void GRecordingCanvas::save() {
+    this->append(GPicture::OpType::kSave, 0);
+}
+
+void GRecordingCanvas::restore() {
+    this->append(GPicture::OpType::kRestore, 0);
+}
+
+void GRecordingCanvas::concat(const GMatrix& matrix) {
+    write(this->append(GPicture::OpType::kConcat, sizeof(GMatrix)), &matrix, 1);
+}
+
+void GRecordingCanvas::clear(const GColor& color) {
+    write(this->append(GPicture::OpType::kClear, sizeof(GColor)), &color, 1);
+}
+
+void GRecordingCanvas::drawRect(const GRect& rect, const GPaint& paint) {
+    const int paintIndex = this->addPaint(paint);
+    uint32_t* dst = this->append(GPicture::OpType::kDrawRect, 4 + sizeof(GRect));
+    dst = write_int(dst, paintIndex);
+    write(dst, &rect, 1);
+}
+
+void GRecordingCanvas::drawConvexPolygon(const GPoint pts[], int count, const GPaint& paint) {
+    if (count < 3) {
+        return;
+    }
+    uint32_t* dst = this->append(GPicture::OpType::kDrawPolygon, 8 + count * sizeof(GPoint));
+    if (!dst) {
+        return;
+    }
+    const int paintIndex = this->addPaint(paint);
+    dst = write_int(dst, paintIndex);
+    dst = write_int(dst, count);
+    write(dst, pts, count);
+}
+
+void GRecordingCanvas::drawPath(const GPath& path, const GPaint& paint) {
+    const int paintIndex = this->addPaint(paint);
+    const int pathIndex = this->addPath(path);
+    uint32_t* dst = this->append(GPicture::OpType::kDrawPath, 8);
+    dst = write_int(dst, paintIndex);
+    write_int(dst, pathIndex);
+}
+
+void GRecordingCanvas::drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
+                                int count, const int indices[], const GPaint& paint) {
+    if (count <= 0) {
+        return;
+    }
+    int vertCount = 0;
+    for (int i = 0; i < count * 3; ++i) {
+        vertCount = std::max(vertCount, indices[i] + 1);
+    }
+
+    size_t bytes = 16 + vertCount * sizeof(GPoint) + count * 3 * sizeof(int);
+    bytes += colors ? vertCount * sizeof(GColor) : 0;
+    bytes += texs ? vertCount * sizeof(GPoint) : 0;
+
+    uint32_t* dst = this->append(GPicture::OpType::kDrawMesh, bytes);
+    if (!dst) {
+        return;
+    }
+    const int paintIndex = this->addPaint(paint);
+    dst = write_int(dst, paintIndex);
+    dst = write_int(dst, count);
+    dst = write_int(dst, vertCount);
+    dst = write_int(dst, (colors ? kHasColors : 0) | (texs ? kHasTexs : 0));
+    dst = write(dst, verts, vertCount);
+    if (colors) {
+        dst = write(dst, colors, vertCount);
+    }
+    if (texs) {
+        dst = write(dst, texs, vertCount);
+    }
+    write(dst, indices, count * 3);
+}
+
+void GRecordingCanvas::drawQuad(const GPoint verts[4], const GColor colors[4],
+                                const GPoint texs[4], int level, const GPaint& paint) {
+    // As on MyCanvas, negative levels draw nothing and finer ones draw at the finest level
+    if (level < 0) {
+        return;
+    }
+    level = std::min(level, GPicture::kMaxQuadLevel);
+    size_t bytes = 12 + 4 * sizeof(GPoint);
+    bytes += colors ? 4 * sizeof(GColor) : 0;
+    bytes += texs ? 4 * sizeof(GPoint) : 0;
+
+    const int paintIndex = this->addPaint(paint);
+    uint32_t* dst = this->append(GPicture::OpType::kDrawQuad, bytes);
+    dst = write_int(dst, paintIndex);
+    dst = write_int(dst, level);
+    dst = write_int(dst, (colors ? kHasColors : 0) | (texs ? kHasTexs : 0));
+    dst = write(dst, verts, 4);
+    if (colors) {
+        dst = write(dst, colors, 4);
+    }
+    if (texs) {
+        write(dst, texs, 4);
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef GPicture_DEFINED
+#define GPicture_DEFINED
+
+#include "./include/GCanvas.h"
+#include "./include/GColor.h"
+#include "./include/GMatrix.h"
+#include "./include/GPaint.h"
+#include "./include/GPath.h"
+#include "./include/GPoint.h"
+#include "./include/GRect.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+/**
+ *  An immutable, replayable list of GCanvas calls, made by GRecordingCanvas.
+ *
+ *  Ops are packed back to back in one buffer of 4-byte words (geometry is copied in, paints
+ *  and paths are referenced by index), while the paints, and the shaders and paths they use,
+ *  are shared with the caller rather than copied.
+ */
+class GPicture {
+public:
+    enum class OpType : uint8_t {
+        kSave,
+        kRestore,
+        kConcat,
+        kClear,
+        kDrawRect,
+        kDrawPolygon,
+        kDrawPath,
+        kDrawMesh,
+        kDrawQuad,
+    };
+
+    // A decoded op. Pointers refer to storage inside the picture; fields not used by the op's
+    // type are left null/zero.
+    struct Op {
+        OpType type;
+        const GMatrix* matrix = nullptr;    // kConcat
+        const GColor* color = nullptr;      // kClear
+        const GRect* rect = nullptr;        // kDrawRect
+        const GPaint* paint = nullptr;      // kDraw...
+        const GPath* path = nullptr;        // kDrawPath
+        int count = 0;                      // Points (polygon), triangles (mesh), level (quad)
+        int vertCount = 0;                  // Entries in points/colors/texs (polygon, mesh, quad)
+        const GPoint* points = nullptr;
+        const GColor* colors = nullptr;
+        const GPoint* texs = nullptr;
+        const int* indices = nullptr;       // kDrawMesh, 3 * count entries
+    };
+
+    // Walks the ops in recording order
+    class Iter {
+    public:
+        // offset must be 0 or a value previously returned by offset()
+        Iter(const GPicture& picture, size_t offset = 0) : fPicture(picture), fOffset(offset) {}
+
+        // Decode the next op into op, returning false when there are no more
+        bool next(Op* op);
+
+        // Offset of the next op, so it can be revisited later with Iter(picture, offset)
+        size_t offset() const { return fOffset; }
+
+    private:
+        const GPicture& fPicture;
+        size_t fOffset;
+    };
+
+    // drawQuad levels past this draw at this level (on MyCanvas too), and pictures holding them
+    // are malformed. It's far finer than any quad needs, and keeps a quad to about a million
+    // vertices.
+    static constexpr int kMaxQuadLevel = 1023;
+
+    int countOps() const { return fOpCount; }
+
+    // Replay every op into canvas, in order
+    void playback(GCanvas* canvas) const;
+
+    // Make a single decoded op on canvas
+    static void Draw(GCanvas* canvas, const Op& op);
+
+private:
+    friend class GRecordingCanvas;
+    friend class PictureFile;
+    GPicture() {}
+
+    // Check that ops from an untrusted source are well formed, so Iter can decode them
+    bool validate() const;
+
+    const uint32_t* fOps = nullptr;         // Points into fOpStorage, or into a mapped file
+    size_t fOpWords = 0;
+    int fOpCount = 0;
+    std::vector<uint32_t> fOpStorage;
+    std::vector<GPaint> fPaints;
+    std::vector<std::shared_ptr<const GPath>> fPaths;
+    std::shared_ptr<const void> fBacking;   // Keeps a mapped file (and what it made) alive
+};
+
+/**
+ *  A GCanvas that records its calls into a GPicture instead of drawing them.
+ */
+class GRecordingCanvas : public GCanvas {
+public:
+    GRecordingCanvas();
+
+    void save() override;
+    void restore() override;
+    void concat(const GMatrix& matrix) override;
+    void clear(const GColor& color) override;
+    void drawRect(const GRect& rect, const GPaint& paint) override;
+    void drawConvexPolygon(const GPoint pts[], int count, const GPaint& paint) override;
+    void drawPath(const GPath& path, const GPaint& paint) override;
+    void drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
+                  int count, const int indices[], const GPaint& paint) override;
+    void drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4],
+                  int level, const GPaint& paint) override;
+
+    // Return the ops recorded so far as a picture, and start recording a new, empty one
+    std::shared_ptr<const GPicture> finishRecording();
+
+private:
+    uint32_t* append(GPicture::OpType type, size_t payloadBytes);
+    int addPaint(const GPaint& paint);
+    int addPath(const GPath& path);
+
+    std::shared_ptr<GPicture> fPicture;
+    std::unordered_map<const GPath*, int> fPathIndices;  // Shared paths already in fPicture
+};
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ *  Replays recorded picture files (see picture_file.h) and reports how long each kind of op took.
+ *
+ *  replay [--reps N] file.gpic ...
+ *  replay [--reps N] --write out.png file.gpic   also write the replayed image
+ *  replay --capture dir                           record every gDrawRecs entry into dir/<name>.gpic
+ */
+
+#include "image.h"
+#include "../include/GBitmap.h"
+#include "../include/GCanvas.h"
+#include "../GPicture.h"
+#include "../picture_file.h"
+#include "../arena.h"
+#include <chrono>
+#include <string>
+
+static const char* gOpNames[] = {
+    "save", "restore", "concat", "clear", "drawRect", "drawPolygon", "drawPath", "drawMesh",
+    "drawQuad",
+};
+
+struct OpStats {
+    int count = 0;
+    double totalMS = 0;
+    double maxMS = 0;
+};
+
+static bool is_arg(const char arg[], const char name[]) {
+    std::string str("--");
+    str += name;
+    if (!strcmp(arg, str.c_str())) {
+        return true;
+    }
+
+    char shortVers[3];
+    shortVers[0] = '-';
+    shortVers[1] = name[0];
+    shortVers[2] = 0;
+    return !strcmp(arg, shortVers);
+}
+
+static int capture(const char dir[]) {
+    int failures = 0;
+    for (int i = 0; gDrawRecs[i].fDraw; ++i) {
+        const GDrawRec& rec = gDrawRecs[i];
+        GRecordingCanvas recorder;
+        recorder.clear({0, 0, 0, 0});
+        rec.fDraw(&recorder);
+
+        std::string path = std::string(dir) + "/" + rec.fName + ".gpic";
+        if (GWritePictureFile(*recorder.finishRecording(), rec.fWidth, rec.fHeight, path.c_str())) {
+            printf("wrote %s\n", path.c_str());
+        } else {
+            fprintf(stderr, "failed to write %s\n", path.c_str());
+            failures += 1;
+        }
+    }
+    return failures ? -1 : 0;
+}
+
+static bool replay(const char path[], int reps, const char out[]) {
+    int width, height;
+    auto picture = GReadPictureFile(path, &width, &height);
+    if (!picture) {
+        fprintf(stderr, "failed to read %s\n", path);
+        return false;
+    }
+
+    GBitmap bitmap;
+    bitmap.alloc(width, height);
+    OpStats stats[GARRAY_COUNT(gOpNames)];
+    double totalMS = 0;
+    auto canvas = GCreateCanvas(bitmap);
+#ifndef NDEBUG
+    size_t newCount = 0;
+#endif
+
+    for (int r = 0; r < reps; ++r) {
+#ifndef NDEBUG
+        newCount = GDebugNewCount();
+#endif
+        GPicture::Iter iter(*picture);
+        GPicture::Op op;
+        while (iter.next(&op)) {
+            auto start = std::chrono::steady_clock::now();
+            GPicture::Draw(canvas.get(), op);
+            std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - start;
+
+            OpStats& s = stats[(int)op.type];
+            s.count += 1;
+            s.totalMS += ms.count();
+            s.maxMS = std::max(s.maxMS, ms.count());
+            totalMS += ms.count();
+        }
+    }
+#ifndef NDEBUG
+    // After the first replay has warmed the canvas up, drawing shouldn't touch the heap
+    newCount = GDebugNewCount() - newCount;
+#endif
+
+    printf("%s: %d ops, [%d %d], %.3f ms per replay\n", path, picture->countOps(), width, height,
+           totalMS / reps);
+    printf("    %-12s %8s %10s %10s %10s\n", "op", "count", "total ms", "avg us", "max us");
+    for (size_t i = 0; i < GARRAY_COUNT(gOpNames); ++i) {
+        if (stats[i].count) {
+            printf("    %-12s %8d %10.3f %10.2f %10.2f\n", gOpNames[i], stats[i].count / reps,
+                   stats[i].totalMS / reps, stats[i].totalMS * 1000 / stats[i].count,
+                   stats[i].maxMS * 1000);
+        }
+    }
+#ifndef NDEBUG
+    printf("    %zu heap allocations in the last replay\n", newCount);
+#endif
+
+    if (out && !bitmap.writeToFile(out)) {
+        fprintf(stderr, "failed to write %s\n", out);
+    }
+    free(bitmap.pixels());
+    return true;
+}
+
+int main(int argc, const char* argv[]) {
+    int reps = 1;
+    const char* out = nullptr;
+    std::vector<const char*> files;
+
+    for (int i = 1; i < argc; ++i) {
+        if (is_arg(argv[i], "capture") && i+1 < argc) {
+            return capture(argv[++i]);
+        } else if (is_arg(argv[i], "reps") && i+1 < argc) {
+            reps = std::max(1, atoi(argv[++i]));
+        } else if (is_arg(argv[i], "write") && i+1 < argc) {
+            out = argv[++i];
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.empty()) {
+        printf("usage: replay [--reps N] file.gpic ...\n"
+               "       replay [--reps N] --write out.png file.gpic\n"
+               "       replay --capture dir\n");
+        return -1;
+    }
+    if (out && files.size() > 1) {
+        fprintf(stderr, "--write takes a single file.gpic, since each would overwrite %s\n", out);
+        return -1;
+    }
+
+    int failures = 0;
+    for (const char* file : files) {
+        failures += !replay(file, reps, out);
+    }
+    return failures ? -1 : 0;
+}
@@ -0,0 +1,854 @@
+/**
+ *  Unit tests for the rasterizer's internals. `make check` builds them twice, with the default
+ *  SSE2 kernels and with the AVX2 ones compiled in, and runs both.
+ */
+
+#include "../blend_modes.h"
+#include "../my_utils.h"
+#include "../threaded_canvas.h"
+#include "../my_canvas.h"
+#include "../picture_file.h"
+#include "../path_cache.h"
+#include "../arena.h"
+#include "../GFinalCustom.h"
+#include "../include/GShader.h"
+#include "../include/GCanvas.h"
+#include "../include/GPathBuilder.h"
+#include "../include/GRandom.h"
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+static int gFailures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,    \
+                         __LINE__, #cond);                                 \
+            gFailures += 1;                                                \
+        }                                                                  \
+    } while (0)
+
+// GDiv255 rounds every product of two 8-bit channels exactly, in each of its versions
+static void test_div255() {
+    for (unsigned a = 0; a < 256; ++a) {
+        unsigned expected[256];
+        for (unsigned b = 0; b < 256; ++b) {
+            expected[b] = (2 * a * b + 255) / 510;  // round(a * b / 255)
+            CHECK(GDiv255(a * b) == expected[b]);
+        }
+#if defined(__SSE2__)
+        for (unsigned b = 0; b < 256; b += 8) {
+            alignas(16) uint16_t lanes[8];
+            for (int i = 0; i < 8; ++i) {
+                lanes[i] = (uint16_t)(a * (b + i));
+            }
+            _mm_store_si128((__m128i*)lanes, GDiv255(_mm_load_si128((const __m128i*)lanes)));
+            for (int i = 0; i < 8; ++i) {
+                CHECK(lanes[i] == expected[b + i]);
+            }
+        }
+#endif
+#if defined(__AVX2__)
+        for (unsigned b = 0; b < 256; b += 16) {
+            alignas(32) uint16_t lanes[16];
+            for (int i = 0; i < 16; ++i) {
+                lanes[i] = (uint16_t)(a * (b + i));
+            }
+            _mm256_store_si256((__m256i*)lanes,
+                               GDiv255(_mm256_load_si256((const __m256i*)lanes)));
+            for (int i = 0; i < 16; ++i) {
+                CHECK(lanes[i] == expected[b + i]);
+            }
+        }
+#endif
+    }
+}
+
+static GPixel random_pixel(GRandom& rand) {
+    const unsigned a = rand.nextRange(0, 255);
+    return GPixel_PackARGB(a, rand.nextRange(0, a), rand.nextRange(0, a), rand.nextRange(0, a));
+}
+
+// The row kernels (AVX2, SSE2 and scalar tail) match the per-pixel procs exactly, for every mode
+// and for lengths that exercise each of the loops
+static void test_blend_rows() {
+    GRandom rand(3);
+    for (int mode = 0; mode < 12; ++mode) {
+        for (int n : {1, 3, 4, 7, 8, 13, 64, 67}) {
+            std::vector<GPixel> src(n), dst(n), row(n), constRow(n);
+            for (int i = 0; i < n; ++i) {
+                src[i] = random_pixel(rand);
+                dst[i] = random_pixel(rand);
+            }
+            row = dst;
+            constRow = dst;
+            gRowProcs[mode](row.data(), src.data(), n);
+            gConstRowProcs[mode](constRow.data(), src[0], n);
+            for (int i = 0; i < n; ++i) {
+                CHECK(row[i] == gProcs[mode](src[i], dst[i]));
+                CHECK(constRow[i] == gProcs[mode](src[0], dst[i]));
+            }
+        }
+    }
+}
+
+// Whether every channel of every pixel is within tolerance
+static bool same_pixels(const GBitmap& a, const GBitmap& b, int tolerance = 0) {
+    for (int y = 0; y < a.height(); ++y) {
+        for (int x = 0; x < a.width(); ++x) {
+            const GPixel pa = *a.getAddr(x, y), pb = *b.getAddr(x, y);
+            for (int shift = 0; shift < 32; shift += 8) {
+                const int ca = (pa >> shift) & 0xFF, cb = (pb >> shift) & 0xFF;
+                if (std::abs(ca - cb) > tolerance) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// A threaded canvas matches a single canvas frame after frame, so its worker pool is reused
+// correctly across flushes (including ones with nothing to draw)
+static void test_threaded_flushes() {
+    GBitmap expected, actual;
+    expected.alloc(300, 200);
+    actual.alloc(300, 200);
+    auto canvas = GCreateCanvas(expected);
+    auto threaded = GCreateThreadedCanvas(actual, 4);
+
+    GRandom rand(6);
+    for (int frame = 0; frame < 20; ++frame) {
+        auto path = GPathBuilder::Build([&](GPathBuilder& builder) {
+            builder.addCircle({rand.nextF() * 300, rand.nextF() * 200}, 10 + rand.nextF() * 80);
+            builder.addRect(GRect::XYWH(rand.nextF() * 300, rand.nextF() * 200, 50, 30));
+        });
+        GPaint paint({rand.nextF(), 0.5f, 0.25f, 0.75f});
+        paint.setAntiAlias(frame & 1);
+        for (GCanvas* c : {canvas.get(), static_cast<GCanvas*>(threaded.get())}) {
+            c->clear({1, 1, 1, 1});
+            c->drawPath(path, paint);
+            c->drawRect(GRect::XYWH(frame * 10, 20, 40, 120), GPaint({0, 0, 1, 0.5f}));
+        }
+        threaded->flush();
+        threaded->flush();
+        CHECK(same_pixels(expected, actual));
+    }
+}
+
+// An op whose payload is over 16MB (past what a 24-bit length could hold) records, reads back
+// from a file and replays like any other, and the ops after it still decode
+static void test_large_picture_op() {
+    const int triangles = 600000, verts = 600000;
+    std::vector<GPoint> points(verts);
+    std::vector<GColor> colors(verts);
+    std::vector<int> indices(3 * triangles);
+    GRandom rand(7);
+    for (int i = 0; i < verts; ++i) {
+        points[i] = {rand.nextF() * 64, rand.nextF() * 64};
+        colors[i] = {rand.nextF(), rand.nextF(), rand.nextF(), 1};
+    }
+    // Only the first hundred triangles cover pixels; the rest are degenerate, so drawing stays fast
+    for (int i = 0; i < 3 * triangles; ++i) {
+        indices[i] = i < 300 ? rand.nextRange(0, verts - 1) : i / 3;
+    }
+
+    auto draw = [&](GCanvas* canvas) {
+        canvas->save();
+        canvas->drawMesh(points.data(), colors.data(), nullptr, triangles, indices.data(),
+                         GPaint());
+        canvas->drawRect(GRect::XYWH(8, 8, 16, 16), GPaint({0, 0, 1, 0.5f}));
+        canvas->restore();
+    };
+    GRecordingCanvas recorder;
+    draw(&recorder);
+    std::shared_ptr<const GPicture> recorded = recorder.finishRecording();
+
+    const char* path = "tests_large_op.gpic";
+    CHECK(GWritePictureFile(*recorded, 64, 64, path));
+    std::shared_ptr<const GPicture> read = GReadPictureFile(path);
+    std::remove(path);
+    CHECK(read);
+
+    GBitmap expected;
+    expected.alloc(64, 64);
+    draw(GCreateCanvas(expected).get());
+    for (const GPicture* picture : {recorded.get(), read.get()}) {
+        if (!picture) {
+            continue;
+        }
+        const GPicture::OpType types[] = {GPicture::OpType::kSave, GPicture::OpType::kDrawMesh,
+                                          GPicture::OpType::kDrawRect,
+                                          GPicture::OpType::kRestore};
+        CHECK(picture->countOps() == 4);
+        GPicture::Iter iter(*picture);
+        GPicture::Op op;
+        for (GPicture::OpType type : types) {
+            CHECK(iter.next(&op) && op.type == type);
+        }
+        CHECK(!iter.next(&op));
+
+        GBitmap actual;
+        actual.alloc(64, 64);
+        picture->playback(GCreateCanvas(actual).get());
+        CHECK(same_pixels(expected, actual));
+    }
+}
+
+// Quad levels out of range are rejected when a picture file is read. Recording pins ones that are
+// too fine, and leaves out negative ones, which draw nothing.
+static void test_picture_quad_level() {
+    const GPoint verts[4] = {{0, 0}, {10, 0}, {10, 10}, {0, 10}};
+    GRecordingCanvas recorder;
+    recorder.drawQuad(verts, nullptr, nullptr, 7, GPaint());
+    recorder.drawQuad(verts, nullptr, nullptr, -1, GPaint());
+    recorder.drawQuad(verts, nullptr, nullptr, GPicture::kMaxQuadLevel + 1, GPaint());
+    std::shared_ptr<const GPicture> picture = recorder.finishRecording();
+    CHECK(picture->countOps() == 2);
+    GPicture::Iter iter(*picture);
+    GPicture::Op quad;
+    CHECK(iter.next(&quad) && quad.count == 7);
+    CHECK(iter.next(&quad) && quad.count == GPicture::kMaxQuadLevel);
+
+    const char* path = "tests_quad_level.gpic";
+    CHECK(GWritePictureFile(*picture, 16, 16, path));
+    std::vector<char> bytes;
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // Find the quad's op (type, payload words, paint, level) and rewrite its level
+    const uint32_t op[4] = {(uint32_t)GPicture::OpType::kDrawQuad, 11, 0, 7};
+    size_t levelAt = 0;
+    for (size_t i = 0; i + sizeof(op) <= bytes.size(); i += 4) {
+        if (memcmp(bytes.data() + i, op, sizeof(op)) == 0) {
+            levelAt = i + 12;
+        }
+    }
+    CHECK(levelAt != 0);
+    for (int level : {7, GPicture::kMaxQuadLevel, GPicture::kMaxQuadLevel + 1, 100000, -1}) {
+        memcpy(bytes.data() + levelAt, &level, sizeof(level));
+        std::ofstream(path, std::ios::binary).write(bytes.data(), bytes.size());
+        const bool valid = level >= 0 && level <= GPicture::kMaxQuadLevel;
+        CHECK((GReadPictureFile(path) != nullptr) == valid);
+    }
+    std::remove(path);
+}
+
+// Minifying a bitmap too small to have a mip level draws from the bitmap itself
+static void test_tiny_mipmaps() {
+    for (int width : {1, 2}) {
+        GBitmap texture;
+        texture.alloc(width, 1);
+        for (int x = 0; x < width; ++x) {
+            *texture.getAddr(x, 0) = 0xFF336699;
+        }
+        GBitmap device;
+        device.alloc(20, 20);
+        auto canvas = GCreateCanvas(device);
+        canvas->clear({1, 1, 1, 1});
+        canvas->scale(0.1f, 0.1f);
+        canvas->drawRect(GRect::WH(200, 200),
+                         GPaint(GCreateBitmapShader(texture, GMatrix(), GTileMode::kRepeat,
+                                                    GFilterQuality::kMipmap)));
+        for (int y = 0; y < 20; ++y) {
+            for (int x = 0; x < 20; ++x) {
+                CHECK(*device.getAddr(x, y) == 0xFF336699);
+            }
+        }
+    }
+}
+
+// drawConvexPolygon and drawPath fill a polygon's pixels alike, since every aliased fill samples
+// rows at their centers
+static void test_polygon_sampling() {
+    GRandom rand(12);
+    for (int draw = 0; draw < 200; ++draw) {
+        // A slanted quad, some sides nearly flat, around a random sub-pixel center
+        const GPoint center = {20 + rand.nextF() * 60, 20 + rand.nextF() * 60};
+        const float angle = rand.nextF() * 6.2831853f;
+        const float w = 5 + rand.nextF() * 40, h = 0.5f + rand.nextF() * 30;
+        const GVector u = {std::cos(angle), std::sin(angle)}, v = {-u.y, u.x};
+        const GPoint quad[4] = {center - u * w - v * h, center + u * w - v * h,
+                                center + u * w + v * h, center - u * w + v * h};
+        auto path = GPathBuilder::Build([&](GPathBuilder& builder) {
+            builder.addPolygon(quad, 4);
+        });
+
+        GBitmap polygon, filled;
+        polygon.alloc(100, 100);
+        filled.alloc(100, 100);
+        auto polygonCanvas = GCreateCanvas(polygon);
+        auto pathCanvas = GCreateCanvas(filled);
+        polygonCanvas->clear({0, 0, 0, 0});
+        pathCanvas->clear({0, 0, 0, 0});
+        polygonCanvas->drawConvexPolygon(quad, 4, GPaint(GColor::RGB(1, 0, 0)));
+        pathCanvas->drawPath(*path, GPaint(GColor::RGB(1, 0, 0)));
+        CHECK(same_pixels(polygon, filled));
+    }
+}
+
+// Anti-aliased fills cover each pixel by the exact area inside them: half a pixel beside a
+// rect's edge at x.5, and the part of a pixel below a diagonal through it. Aliased fills still
+// take whole pixels whose centers are inside, just as before anti-aliasing was added.
+static void test_aa_coverage() {
+    const GPixel red = GPixel_PackARGB(0xFF, 0xFF, 0, 0);
+    auto near = [](GPixel pixel, int alpha) {
+        // Opaque red over clear blends to red at the coverage, give or take rounding
+        return std::abs((int)GPixel_GetA(pixel) - alpha) <= 1 &&
+               GPixel_GetR(pixel) == GPixel_GetA(pixel) && GPixel_GetG(pixel) == 0 &&
+               GPixel_GetB(pixel) == 0;
+    };
+    auto draw = [](bool antiAlias, auto proc) {
+        GBitmap device;
+        device.alloc(32, 32);
+        std::memset(device.pixels(), 0, 32 * device.rowBytes());
+        GPaint paint(GColor::RGB(1, 0, 0));
+        paint.setAntiAlias(antiAlias);
+        proc(*GCreateCanvas(device), paint);
+        return device;
+    };
+
+    GBitmap rect = draw(true, [](GCanvas& canvas, const GPaint& paint) {
+        canvas.drawRect(GRect::LTRB(10.5f, 4, 20, 12), paint);
+    });
+    for (int y = 4; y < 12; ++y) {
+        CHECK(*rect.getAddr(9, y) == 0);
+        CHECK(near(*rect.getAddr(10, y), 128));
+        for (int x = 11; x < 20; ++x) {
+            CHECK(*rect.getAddr(x, y) == red);
+        }
+        CHECK(*rect.getAddr(20, y) == 0);
+    }
+    CHECK(*rect.getAddr(15, 3) == 0 && *rect.getAddr(15, 12) == 0);
+
+    // The hypotenuse y = 8 - x/2 crosses pixel (4, 5) from (4, 6) to (5, 5.5), leaving 3/4 of it
+    // inside, and pixel (9, 3) from (9, 3.5) to (10, 3), leaving 1/4
+    const GPoint triangle[] = {{0, 0}, {16, 0}, {0, 8}};
+    auto path = GPathBuilder::Build([&](GPathBuilder& builder) {
+        builder.addPolygon(triangle, 3);
+    });
+    for (bool usePath : {false, true}) {
+        auto fill = [&](GCanvas& canvas, const GPaint& paint) {
+            if (usePath) {
+                canvas.drawPath(*path, paint);
+            } else {
+                canvas.drawConvexPolygon(triangle, 3, paint);
+            }
+        };
+        GBitmap smooth = draw(true, fill);
+        CHECK(*smooth.getAddr(2, 2) == red);
+        CHECK(near(*smooth.getAddr(4, 5), 191));
+        CHECK(near(*smooth.getAddr(9, 3), 64));
+        CHECK(*smooth.getAddr(12, 6) == 0);
+
+        // No pixel center lies on the hypotenuse, so which pixels are inside is never a tie
+        GBitmap aliased = draw(false, fill);
+        for (int y = 0; y < 32; ++y) {
+            for (int x = 0; x < 32; ++x) {
+                const bool inside = y + 0.5f < 8 - (x + 0.5f) / 2;
+                CHECK(*aliased.getAddr(x, y) == (inside ? red : 0));
+            }
+        }
+    }
+    for (float left : {10.25f, 10.75f}) {
+        GBitmap aliased = draw(false, [&](GCanvas& canvas, const GPaint& paint) {
+            canvas.drawRect(GRect::LTRB(left, 4.25f, 20, 11.75f), paint);
+        });
+        for (int y = 0; y < 32; ++y) {
+            for (int x = 0; x < 32; ++x) {
+                const bool inside = x + 0.5f > left && x < 20 && y >= 4 && y < 12;
+                CHECK(*aliased.getAddr(x, y) == (inside ? red : 0));
+            }
+        }
+    }
+}
+
+// A mipmap shader made over pixels that were redrawn since another shader minified them sees the
+// new pixels, even while the older shader is alive
+static void test_redrawn_mipmaps() {
+    GBitmap texture;
+    texture.alloc(64, 64);
+    auto offscreen = GCreateCanvas(texture);
+    auto minify = [&](const GColor& color) {
+        offscreen->clear(color);
+        auto shader = GCreateBitmapShader(texture, GMatrix(), GTileMode::kRepeat,
+                                          GFilterQuality::kMipmap);
+        GBitmap device;
+        device.alloc(8, 8);
+        auto canvas = GCreateCanvas(device);
+        canvas->scale(0.125f, 0.125f);
+        canvas->drawRect(GRect::WH(64, 64), GPaint(shader));
+        return std::make_pair(shader, *device.getAddr(4, 4));
+    };
+
+    auto red = minify(GColor::RGB(1, 0, 0));
+    auto blue = minify(GColor::RGB(0, 0, 1));
+    CHECK(red.second == GPixel_PackARGB(0xFF, 0xFF, 0, 0));
+    CHECK(blue.second == GPixel_PackARGB(0xFF, 0, 0, 0xFF));
+}
+
+// The Voronoi shader's grid search finds a nearest site for every pixel, under rotated and
+// scaled CTMs, for sites with duplicates among them and for sites spread far past the device
+// around a dense cluster. Sites at the same distance are interchangeable, so a pixel passes if
+// any site with its color is as near as the nearest of all of them.
+static void test_voronoi_nearest() {
+    GRandom rand(19);
+    auto final = GCreateFinal();
+    for (float spread : {0.0f, 1e5f}) {
+        std::vector<GPoint> points;
+        for (int i = 0; i < 3000; ++i) {
+            if (i % 6 == 5) {
+                points.push_back(points[rand.nextRange(0, i - 1)]);
+            } else if (spread > 0 && i % 6 > 1) {
+                points.push_back({(rand.nextF() - 0.5f) * spread, (rand.nextF() - 0.5f) * spread});
+            } else {
+                points.push_back({rand.nextF() * 300, rand.nextF() * 300});
+            }
+        }
+        // Each site its own color
+        std::vector<GColor> colors;
+        std::vector<GPixel> pixels;
+        for (int i = 0; i < (int)points.size(); ++i) {
+            colors.push_back(GColor::RGB((i & 0xFF) / 255.0f, ((i >> 8) & 0xFF) / 255.0f, 1));
+            pixels.push_back(GColorToPixel(colors.back()));
+        }
+        auto shader = final->createVoronoiShader(points.data(), colors.data(), (int)points.size());
+
+        for (int draw = 0; draw < 3; ++draw) {
+            const GMatrix ctm = GMatrix::Translate(64, 64) *
+                                GMatrix::Rotate(rand.nextF() * 6.2831853f) *
+                                GMatrix::Scale(0.2f + rand.nextF(), 0.2f + rand.nextF()) *
+                                GMatrix::Translate(-150, -150);
+            const GMatrix inverse = *ctm.invert();
+            GPoint cover[4] = {{-1, -1}, {129, -1}, {129, 129}, {-1, 129}};
+            inverse.mapPoints(cover, 4);
+
+            GBitmap device;
+            device.alloc(128, 128);
+            auto canvas = GCreateCanvas(device);
+            canvas->concat(ctm);
+            canvas->drawConvexPolygon(cover, 4, GPaint(shader));
+
+            for (int y = 0; y < 128; ++y) {
+                for (int x = 0; x < 128; ++x) {
+                    const GPoint p = inverse * GPoint{x + 0.5f, y + 0.5f};
+                    const GPixel pixel = *device.getAddr(x, y);
+                    float nearest = INFINITY, shaded = INFINITY;
+                    for (int i = 0; i < (int)points.size(); ++i) {
+                        const float dx = points[i].x - p.x, dy = points[i].y - p.y;
+                        nearest = std::min(nearest, dx * dx + dy * dy);
+                        if (pixels[i] == pixel) {
+                            shaded = std::min(shaded, dx * dx + dy * dy);
+                        }
+                    }
+                    CHECK(shaded <= nearest * (1 + 1e-5f));
+                }
+            }
+        }
+    }
+}
+
+// The color matrix kernels (AVX2, SSE2 and scalar tail) match unpremultiplying, applying the
+// matrix to a GColor and converting it back, to within 1 per channel. Matrices whose color rows
+// don't read alpha take the path that applies them to premultiplied pixels directly.
+static void test_color_matrix() {
+    GRandom rand(20);
+    GBitmap texture;
+    texture.alloc(40, 8);
+    for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 40; ++x) {
+            *texture.getAddr(x, y) = random_pixel(rand);
+        }
+    }
+    auto realShader = GCreateBitmapShader(texture, GMatrix(), GTileMode::kClamp,
+                                          GFilterQuality::kNearest);
+
+    const float sr = 0.299f, sg = 0.587f, sb = 0.114f;
+    std::array<float, 20> general;
+    for (float& v : general) {
+        v = rand.nextF() * 2.5f - 1;
+    }
+    const GColorMatrix matrices[] = {
+        GColorMatrix({sr, sr, sr, 0,
+                      sg, sg, sg, 0,
+                      sb, sb, sb, 0,
+                       0,  0,  0, 1,
+                       0,  0,  0, 0}),
+        GColorMatrix({sr, sr, sr, 0,
+                      sg, sg, sg, 0,
+                      sb, sb, sb, 0,
+                       0,  0,  0, 1,
+                      0.1f, -0.05f, 0.2f, 0}),
+        GColorMatrix({1, 0, 0, 0,
+                      0, 1, 0, 0,
+                      0, 0, 1, 0,
+                      0.5f, -0.25f, 0, 1,
+                      0, 0, 0, 0}),
+        GColorMatrix(general),
+    };
+    auto final = GCreateFinal();
+    for (const GColorMatrix& m : matrices) {
+        GPaint paint(final->createColorMatrixShader(m, realShader.get()));
+        paint.setBlendMode(GBlendMode::kSrc);
+        for (int width : {1, 3, 4, 7, 8, 13, 19, 40}) {
+            GBitmap device;
+            device.alloc(40, 8);
+            auto canvas = GCreateCanvas(device);
+            canvas->drawRect(GRect::WH(width, 8), paint);
+
+            for (int y = 0; y < 8; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    const GPixel src = *texture.getAddr(x, y);
+                    const float a = GPixel_GetA(src) / 255.0f;
+                    const float unpremul = a > 0 ? 1 / (a * 255) : 0;
+                    const float c[5] = {GPixel_GetR(src) * unpremul, GPixel_GetG(src) * unpremul,
+                                        GPixel_GetB(src) * unpremul, a, 1};
+                    float out[4];
+                    for (int row = 0; row < 4; ++row) {
+                        out[row] = 0;
+                        for (int col = 0; col < 5; ++col) {
+                            out[row] += m[col * 4 + row] * c[col];
+                        }
+                    }
+                    const GPixel expected = GColorToPixel({out[0], out[1], out[2], out[3]});
+                    const GPixel actual = *device.getAddr(x, y);
+                    for (int shift : {GPIXEL_SHIFT_A, GPIXEL_SHIFT_R, GPIXEL_SHIFT_G,
+                                      GPIXEL_SHIFT_B}) {
+                        CHECK(std::abs((int)((expected >> shift) & 0xFF) -
+                                       (int)((actual >> shift) & 0xFF)) <= 1);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// A sweep gradient's polynomial atan2 (on every lane of the AVX2 or SSE2 loop, and in the
+// scalar tail) places each pixel within one color step of std::atan2 all the way around its
+// center. Drawn under a rotation, it matches the unrotated gradient with the start angle turned
+// by as much.
+static void test_sweep_angles() {
+    auto final = GCreateFinal();
+    const GColor ramp[] = {GColor::RGB(0, 0, 0), GColor::RGB(1, 1, 1)};
+    const GPoint center = {33.3f, 30.7f};
+    auto draw = [&](float startRadians, float rotation) {
+        GBitmap device;
+        device.alloc(67, 67);
+        auto canvas = GCreateCanvas(device);
+        canvas->translate(center.x, center.y);
+        canvas->rotate(rotation);
+        canvas->drawRect(GRect::LTRB(-100, -100, 100, 100),
+                         GPaint(final->createSweepGradient({0, 0}, startRadians, ramp, 2)));
+        return device;
+    };
+
+    for (float start : {0.0f, 1.0f, -2.5f}) {
+        GBitmap device = draw(start, 0);
+        for (int y = 0; y < 67; ++y) {
+            for (int x = 0; x < 67; ++x) {
+                double t = (std::atan2(y + 0.5 - center.y, x + 0.5 - center.x) - start) /
+                           (2 * M_PI);
+                t -= std::floor(t);
+                if (t * 255 < 1 || t * 255 > 254) {
+                    continue;  // Next to where the ramp starts over, either end is as near
+                }
+                CHECK(std::abs(GPixel_GetR(*device.getAddr(x, y)) - t * 255) <= 1);
+            }
+        }
+    }
+
+    for (float rotation : {0.3f, 2.0f, -1.2f}) {
+        GBitmap rotated = draw(0.5f, rotation);
+        GBitmap turned = draw(0.5f + rotation, 0);
+        for (int y = 0; y < 67; ++y) {
+            for (int x = 0; x < 67; ++x) {
+                const int a = GPixel_GetR(*rotated.getAddr(x, y));
+                const int b = GPixel_GetR(*turned.getAddr(x, y));
+                CHECK(std::abs(a - b) <= 1 || (std::min(a, b) < 3 && std::max(a, b) > 252));
+            }
+        }
+    }
+}
+
+// Curves flatten into more segments the more the CTM magnifies them (by Wang's formula, as the
+// square root of the scale), and every segment stays within drawPath's quarter pixel of the
+// curve in device space. That includes a cubic looping back to its start, and one that is a
+// single point, which takes one segment at any scale.
+static void test_curve_flattening() {
+    const GPoint curves[][4] = {
+        {{0, 0}, {40, 10}, {20, 40}},              // A quad
+        {{0, 0}, {40, 0}, {0, 40}, {40, 40}},      // An S
+        {{5, 5}, {45, 40}, {-5, 40}, {5, 5}},      // A loop, ending where it starts
+        {{20, 20}, {20, 20}, {20, 20}, {20, 20}},  // A point
+    };
+    for (int c = 0; c < 4; ++c) {
+        const GPoint* pts = curves[c];
+        const bool quad = c == 0;
+        auto path = GPathBuilder::Build([&](GPathBuilder& builder) {
+            builder.moveTo(pts[0]);
+            if (quad) {
+                builder.quadTo(pts[1], pts[2]);
+            } else {
+                builder.cubicTo(pts[1], pts[2], pts[3]);
+            }
+        });
+
+        int lastCount = 0;
+        for (float scale : {1.0f, 4.0f, 16.0f}) {
+            const GMatrix ctm = GMatrix::Scale(scale, scale) * GMatrix::Rotate(0.3f);
+            GBitmap device;
+            device.alloc(512, 512);
+            MyCanvas canvas(device);
+            canvas.concat(ctm);
+            canvas.drawPath(*path, GPaint());
+            auto flattened = PathCache::Find(*path, ctm);
+            CHECK(flattened != nullptr);
+            if (!flattened) {
+                continue;
+            }
+
+            // The curve's segments, then the line closing the contour
+            const std::vector<GPoint>& points = flattened->points;
+            const int count = (int)points.size() / 2 - 1;
+            if (c == 3) {
+                CHECK(count == 1);
+            } else {
+                CHECK(count > lastCount);
+            }
+            lastCount = count;
+
+            GPoint mapped[4];
+            ctm.mapPoints(mapped, pts, quad ? 3 : 4);
+            auto eval = [&](double t) -> GPoint {
+                const double u = 1 - t;
+                const double w[4] = {u * u * u, 3 * u * u * t, 3 * u * t * t, t * t * t};
+                const double q[3] = {u * u, 2 * u * t, t * t};
+                double x = 0, y = 0;
+                for (int i = 0; i < (quad ? 3 : 4); ++i) {
+                    x += (quad ? q[i] : w[i]) * mapped[i].x;
+                    y += (quad ? q[i] : w[i]) * mapped[i].y;
+                }
+                return {(float)x, (float)y};
+            };
+            CHECK(points[0] == mapped[0]);
+            CHECK(points[2 * count - 1] == mapped[quad ? 2 : 3]);
+            for (int i = 0; i < count; ++i) {
+                const GPoint a = points[2 * i], b = points[2 * i + 1];
+                CHECK(i == 0 || a == points[2 * i - 1]);
+                for (int k = 0; k <= 16; ++k) {
+                    // The distance from the curve to the segment stepped over that part of it
+                    const GPoint p = eval((i + k / 16.0) / count);
+                    const GVector ab = b - a, ap = p - a;
+                    const float len2 = ab.x * ab.x + ab.y * ab.y;
+                    const float t = len2 > 0 ? (ap.x * ab.x + ap.y * ab.y) / len2 : 0;
+                    CHECK((ap - ab * std::clamp(t, 0.0f, 1.0f)).length() <= 0.25f + 1e-3f * scale);
+                }
+            }
+        }
+    }
+}
+
+// A shared path drawn again under a CTM that differs only in translation (fractional, here)
+// reuses its cached flattening, and draws as a path the cache can't hold does. A CTM with another
+// scale, rotation or skew misses. An entry whose path was freed is never used for another path
+// that takes its address.
+static void test_path_cache() {
+    const std::vector<GPathVerb> verbs = {GPathVerb::kMove, GPathVerb::kCubic, GPathVerb::kQuad,
+                                          GPathVerb::kLine};
+    const std::vector<GPoint> pts = {{10, 10}, {90, -20}, {100, 80}, {40, 60},
+                                     {0, 90},  {30, 30},  {5, 40}};
+    const std::vector<GPoint> otherPts = {{60, 5},  {0, 0},   {10, 100}, {70, 90},
+                                          {90, 40}, {20, 50}, {80, 10}};
+    auto same_draws = [](const GPath& cached, const GPath& uncached, const GMatrix& ctm) {
+        bool same = true;
+        for (bool antiAlias : {false, true}) {
+            GPaint paint(GColor::RGB(0, 0.5f, 1));
+            paint.setAntiAlias(antiAlias);
+            GBitmap expected, actual;
+            expected.alloc(128, 128);
+            actual.alloc(128, 128);
+            std::memset(expected.pixels(), 0, 128 * expected.rowBytes());
+            std::memset(actual.pixels(), 0, 128 * actual.rowBytes());
+            MyCanvas expectedCanvas(expected), actualCanvas(actual);
+            expectedCanvas.concat(ctm);
+            actualCanvas.concat(ctm);
+            expectedCanvas.drawPath(uncached, paint);
+            actualCanvas.drawPath(cached, paint);
+            // Cached segments are translated after they're mapped, which can round coverage
+            // differently
+            same &= same_pixels(expected, actual, antiAlias ? 1 : 0);
+        }
+        return same;
+    };
+    auto transform = [](float tx, float ty, float sy) {
+        return GMatrix::Translate(tx, ty) * GMatrix::Rotate(0.4f) * GMatrix::Scale(0.9f, sy);
+    };
+
+    auto shared = std::make_shared<GPath>(pts, verbs);
+    const GPath uncached(pts, verbs);
+    CHECK(!PathCache::Find(*shared, transform(0, 0, 0.8f)));
+    CHECK(same_draws(*shared, uncached, transform(20.25f, 3.6f, 0.8f)));
+    auto segments = PathCache::Find(*shared, transform(0, 0, 0.8f));
+    CHECK(segments != nullptr);
+    CHECK(same_draws(*shared, uncached, transform(31.7f, -2.125f, 0.8f)));
+    CHECK(PathCache::Find(*shared, transform(-5.5f, 9.3f, 0.8f)) == segments);
+    CHECK(!PathCache::Find(*shared, transform(0, 0, 0.8001f)));
+    CHECK(!PathCache::Find(uncached, transform(0, 0, 0.8f)));
+
+    // Allocated apart from its control block, so freeing a path frees its address for the next
+    // one (where the allocator hands it out again) while the cache still holds it weakly
+    std::shared_ptr<GPath> freed(new GPath(pts, verbs));
+    const GMatrix ctm = transform(40.5f, 0.75f, 1.1f);
+    CHECK(same_draws(*freed, uncached, ctm));
+    const GPath* address = freed.get();
+    freed.reset();
+    std::vector<std::shared_ptr<GPath>> others;
+    for (int i = 0; i < 16 && (others.empty() || others.back().get() != address); ++i) {
+        others.emplace_back(new GPath(otherPts, verbs));
+    }
+    CHECK(!PathCache::Find(*others.back(), ctm));
+    CHECK(same_draws(*others.back(), GPath(otherPts, verbs), ctm));
+}
+
+// Drawing a path in tiles matches drawing it whole, though each tile culls the parts of the path
+// outside it. Every contour ends in a curve, so it's closed by the line drawPath adds back to its
+// start, which culling relies on. The wider paths are too large to cache and are culled a verb at
+// a time; the others are cached and culled a run of segments at a time.
+static void test_cull_to_clip() {
+    const int size = 256, tile = 64;
+    GRandom rand(7);
+    for (float span : {600.0f, 400.0f}) {
+        for (int draw = 0; draw < 20; ++draw) {
+            auto random_point = [&]() -> GPoint {
+                return {rand.nextF() * span - (span - size) / 2,
+                        rand.nextF() * span - (span - size) / 2};
+            };
+            auto path = GPathBuilder::Build([&](GPathBuilder& builder) {
+                for (int contour = 0; contour < 3; ++contour) {
+                    builder.moveTo(random_point());
+                    builder.cubicTo(random_point(), random_point(), random_point());
+                    builder.quadTo(random_point(), random_point());
+                }
+            });
+            GPaint paint({1, rand.nextF(), 0.5f, 1});
+            paint.setBlendMode(GBlendMode::kSrc);
+
+            GBitmap expected, actual;
+            expected.alloc(size, size);
+            actual.alloc(size, size);
+            std::memset(expected.pixels(), 0, size * expected.rowBytes());
+            std::memset(actual.pixels(), 0, size * actual.rowBytes());
+            MyCanvas(expected).drawPath(*path, paint);
+            for (int y = 0; y < size; y += tile) {
+                for (int x = 0; x < size; x += tile) {
+                    MyCanvas(actual, GIRect::XYWH(x, y, tile, tile)).drawPath(*path, paint);
+                }
+            }
+            CHECK(same_pixels(expected, actual));
+        }
+    }
+}
+
+#ifndef NDEBUG
+// Once a canvas has replayed a picture, replaying it again doesn't touch the heap: every draw's
+// temporaries come from the canvas's arena and scratch buffers
+static void test_replay_allocations() {
+    GBitmap texture;
+    texture.alloc(8, 8);
+    for (int y = 0; y < 8; ++y) {
+        for (int x = 0; x < 8; ++x) {
+            *texture.getAddr(x, y) = (x + y) & 1 ? 0xFFFF0000 : 0xFF0000FF;
+        }
+    }
+    const GColor colors[] = {{1, 0, 0, 1}, {0, 1, 0, 0.5f}, {0, 0, 1, 1}, {1, 1, 0, 0.75f}};
+    const GPoint quad[] = {{10, 10}, {90, 20}, {80, 90}, {20, 80}};
+    const GPoint texs[] = {{0, 0}, {8, 0}, {8, 8}, {0, 8}};
+    const int indices[] = {0, 1, 2, 0, 2, 3};
+    auto path = GPathBuilder::Build([](GPathBuilder& builder) {
+        builder.addCircle({50, 50}, 40);
+        builder.moveTo({5, 5});
+        builder.cubicTo({90, 0}, {0, 90}, {95, 95});
+    });
+
+    GRecordingCanvas recorder;
+    recorder.clear({1, 1, 1, 1});
+    recorder.save();
+    recorder.concat(GMatrix::Rotate(0.2f));
+    recorder.drawRect(GRect::XYWH(10, 10, 50, 30), GPaint({0, 0, 1, 0.5f}));
+    recorder.drawConvexPolygon(quad, 4, GPaint({0, 1, 0, 1}));
+    recorder.restore();
+    for (bool antiAlias : {false, true}) {
+        GPaint paint({1, 0, 0, 0.5f});
+        paint.setAntiAlias(antiAlias);
+        recorder.drawPath(*path, paint);
+    }
+    GPaint gradient(GCreateLinearGradient({0, 0}, {100, 100}, colors, 4, GTileMode::kMirror));
+    recorder.drawRect(GRect::XYWH(0, 60, 100, 40), gradient);
+    recorder.drawMesh(quad, colors, nullptr, 2, indices, GPaint());
+    GPaint bitmap(GCreateBitmapShader(texture, GMatrix(), GTileMode::kRepeat,
+                                      GFilterQuality::kBilinear));
+    recorder.drawQuad(quad, colors, texs, 3, bitmap);
+    std::shared_ptr<const GPicture> picture = recorder.finishRecording();
+
+    GBitmap device;
+    device.alloc(100, 100);
+    const size_t before = GDebugNewCount();
+    auto canvas = GCreateCanvas(device);
+    picture->playback(canvas.get());
+    const size_t newCount = GDebugNewCount();
+    CHECK(newCount > before);  // The counter works: making and warming up the canvas allocates
+    picture->playback(canvas.get());
+    CHECK(GDebugNewCount() == newCount);
+}
+#endif
+
+int main() {
+#if defined(__AVX2__)
+    if (!__builtin_cpu_supports("avx2")) {
+        std::printf("skipped: built with AVX2, which this CPU doesn't have\n");
+        return 0;
+    }
+    const char* kernels = "AVX2";
+#elif defined(__SSE2__)
+    const char* kernels = "SSE2";
+#else
+    const char* kernels = "scalar";
+#endif
+
+    const struct {
+        const char* name;
+        void (*proc)();
+    } tests[] = {
+        {"div255", test_div255},
+        {"blend_rows", test_blend_rows},
+        {"threaded_flushes", test_threaded_flushes},
+        {"large_picture_op", test_large_picture_op},
+        {"picture_quad_level", test_picture_quad_level},
+        {"polygon_sampling", test_polygon_sampling},
+        {"aa_coverage", test_aa_coverage},
+        {"tiny_mipmaps", test_tiny_mipmaps},
+        {"redrawn_mipmaps", test_redrawn_mipmaps},
+        {"cull_to_clip", test_cull_to_clip},
+        {"voronoi_nearest", test_voronoi_nearest},
+        {"color_matrix", test_color_matrix},
+        {"sweep_angles", test_sweep_angles},
+        {"curve_flattening", test_curve_flattening},
+        {"path_cache", test_path_cache},
+#ifndef NDEBUG
+        {"replay_allocations", test_replay_allocations},
+#endif
+    };
+    for (const auto& test : tests) {
+        const int failures = gFailures;
+        test.proc();
+        std::printf("%s %s (%s)\n", gFailures == failures ? "ok  " : "FAIL", test.name, kernels);
+    }
+    return gFailures ? 1 : 0;
+}
@@ -0,0 +1,71 @@
+#include "arena.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifndef NDEBUG
+#include <atomic>
+#endif
+
+Arena::Arena(size_t initialBytes) {
+    this->newBlock(initialBytes);
+}
+
+void Arena::newBlock(size_t minBytes) {
+    if (fBlock) {
+        fFullBytes += fBlockSize;
+        fFullBlocks.push_back(std::move(fBlock));
+    }
+    // Grow geometrically, so a draw that outgrows the arena only adds a few blocks
+    fBlockSize = std::max(minBytes, fBlockSize + fFullBytes);
+    fBlock.reset(new char[fBlockSize]);
+    fCurr = fBlock.get();
+    fEnd = fCurr + fBlockSize;
+}
+
+void* Arena::alloc(size_t bytes, size_t align) {
+    uintptr_t p = (reinterpret_cast<uintptr_t>(fCurr) + align - 1) & ~(uintptr_t)(align - 1);
+    if (p + bytes > reinterpret_cast<uintptr_t>(fEnd)) {
+        this->newBlock(bytes + align);
+        p = (reinterpret_cast<uintptr_t>(fCurr) + align - 1) & ~(uintptr_t)(align - 1);
+    }
+    fCurr = reinterpret_cast<char*>(p + bytes);
+    return reinterpret_cast<void*>(p);
+}
+
+void Arena::reset() {
+    if (!fFullBlocks.empty()) {
+        // Replace the blocks with one that holds them all, so the next draw like this one fits
+        const size_t total = fFullBytes + fBlockSize;
+        fFullBlocks.clear();
+        fFullBytes = 0;
+        fBlock.reset();
+        this->newBlock(total);
+    }
+    fCurr = fBlock.get();
+}
+
+#ifndef NDEBUG
+static std::atomic<size_t> gNewCount{0};
+
+size_t GDebugNewCount() {
+    return gNewCount.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size) {
+    gNewCount.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+#endif
@@ -0,0 +1,116 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Bump allocator for the temporaries of a single draw (segments, edges, active lists, ...).
+// Allocating just advances a pointer, and nothing is freed until the arena is reset. A reset
+// that had to grow the arena merges its blocks into one, so once a canvas has drawn its
+// largest draw, further draws allocate nothing from the heap.
+class Arena {
+public:
+    explicit Arena(size_t initialBytes = 16 * 1024);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    void* alloc(size_t bytes, size_t align);
+
+    // Uninitialized storage for count Ts
+    template <typename T> T* makeArray(size_t count) {
+        return static_cast<T*>(this->alloc(count * sizeof(T), alignof(T)));
+    }
+
+    // Construct a T in the arena. Its destructor is never run.
+    template <typename T, typename... Args> T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "the arena never runs destructors");
+        return new (this->alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Release everything allocated so far. Pointers into the arena become invalid.
+    void reset();
+
+    // Resets the arena when the outermost scope on it ends, so a draw that is implemented by
+    // another (e.g. drawQuad calling drawMesh) keeps its allocations until it returns.
+    class Scope {
+    public:
+        explicit Scope(Arena& arena) : fArena(arena) { fArena.fDepth += 1; }
+        ~Scope() {
+            if (--fArena.fDepth == 0) {
+                fArena.reset();
+            }
+        }
+
+    private:
+        Arena& fArena;
+    };
+
+    // Gives back what was allocated during its lifetime when it ends, for the temporaries of
+    // one step of a draw (e.g. one triangle of a mesh)
+    class Rewind {
+    public:
+        explicit Rewind(Arena& arena)
+            : fArena(arena), fBlock(arena.fBlock.get()), fCurr(arena.fCurr) {}
+        ~Rewind() {
+            // If the step moved to a new block, its memory stays until the arena resets
+            if (fArena.fBlock.get() == fBlock) {
+                fArena.fCurr = fCurr;
+            }
+        }
+
+    private:
+        Arena& fArena;
+        char* fBlock;
+        char* fCurr;
+    };
+
+private:
+    void newBlock(size_t minBytes);
+
+    std::unique_ptr<char[]> fBlock;
+    size_t fBlockSize = 0;
+    char* fCurr = nullptr;
+    char* fEnd = nullptr;
+    std::vector<std::unique_ptr<char[]>> fFullBlocks;  // Blocks outgrown since the last reset
+    size_t fFullBytes = 0;
+    int fDepth = 0;
+};
+
+// std::allocator-compatible wrapper, so standard containers can live in an arena. Freeing is a
+// no-op; the memory comes back when the arena resets.
+template <typename T> class ArenaAllocator {
+public:
+    using value_type = T;
+
+    ArenaAllocator(Arena& arena) : fArena(&arena) {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U>& other) : fArena(other.fArena) {}
+
+    T* allocate(size_t count) { return fArena->makeArray<T>(count); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U> bool operator==(const ArenaAllocator<U>& other) const {
+        return fArena == other.fArena;
+    }
+    template <typename U> bool operator!=(const ArenaAllocator<U>& other) const {
+        return fArena != other.fArena;
+    }
+
+private:
+    template <typename U> friend class ArenaAllocator;
+    Arena* fArena;
+};
+
+template <typename T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#ifndef NDEBUG
+// Number of calls to the global operator new so far. Debug builds count them, so tests and
+// tools can check that steady-state drawing doesn't touch the heap.
+size_t GDebugNewCount();
+#endif
+
+#endif
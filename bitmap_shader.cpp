@@ -1,66 +1,375 @@
 #include "bitmap_shader.h"
+#include "arena.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
 
-BitmapShader::BitmapShader(const GBitmap& bitmap, const GMatrix& localMatrix, GTileMode tileMode)
-    : fBitmap(bitmap), fLocalMatrix(localMatrix), fTileMode(tileMode) {
+BitmapShader::BitmapShader(const GBitmap& bitmap, const GMatrix& localMatrix, GTileMode tileMode,
+                           GFilterQuality filter)
+    : fBitmap(bitmap), fLocalMatrix(localMatrix), fTileMode(tileMode), fFilter(filter) {
     fOpaque = bitmap.isOpaque();
 }
 
-bool BitmapShader::isOpaque() {
+bool BitmapShader::isOpaque() const {
     return fOpaque;
 }
 
-bool BitmapShader::setContext(const GMatrix& ctm) {
-    GMatrix totalMatrix = GMatrix::Concat(ctm, fLocalMatrix);
-    auto invMatrix = totalMatrix.invert();
-    if (!invMatrix) {
-        return false;
+namespace {
+
+// Map a source column (or row) onto [0, n) for each tile mode. Coordinates already inside are
+// by far the most common, so repeat and mirror check for that before paying for a modulo.
+template <GTileMode> int tile(int i, int n);
+
+template <> inline int tile<GTileMode::kClamp>(int i, int n) {
+    return std::clamp(i, 0, n - 1);
+}
+
+template <> inline int tile<GTileMode::kRepeat>(int i, int n) {
+    if ((unsigned)i < (unsigned)n) {
+        return i;
+    }
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+template <> inline int tile<GTileMode::kMirror>(int i, int n) {
+    if ((unsigned)i < (unsigned)n) {
+        return i;
+    }
+    i %= 2 * n;
+    if (i < 0) i += 2 * n;
+    return i >= n ? 2 * n - i - 1 : i;
+}
+
+template <GTileMode M> using TileTag = std::integral_constant<GTileMode, M>;
+
+// Call fn with the tile mode as a compile-time constant, so each kernel is compiled per mode
+template <typename Fn> void with_tile_mode(GTileMode mode, Fn&& fn) {
+    switch (mode) {
+        case GTileMode::kClamp:  fn(TileTag<GTileMode::kClamp>()); break;
+        case GTileMode::kRepeat: fn(TileTag<GTileMode::kRepeat>()); break;
+        case GTileMode::kMirror: fn(TileTag<GTileMode::kMirror>()); break;
     }
-    fInverse = *invMatrix;
-    return true;
 }
 
-void BitmapShader::shadeRow(int x, int y, int count, GPixel row[]) {
-    for (int i = 0; i < count; ++i) {
-        GPoint srcPoint = { x + i + 0.5f, y + 0.5f };
-        fInverse.mapPoints(&srcPoint, &srcPoint, 1);
-
-        int bitmapX, bitmapY;
-        switch (fTileMode) {
-            case GTileMode::kClamp:
-                bitmapX = std::clamp(static_cast<int>(std::floor(srcPoint.x)), 0, fBitmap.width() - 1);
-                bitmapY = std::clamp(static_cast<int>(std::floor(srcPoint.y)), 0, fBitmap.height() - 1);
-                break;
-
-            case GTileMode::kRepeat:
-                bitmapX = static_cast<int>(std::floor(srcPoint.x)) % fBitmap.width();
-                if (bitmapX < 0) bitmapX += fBitmap.width(); 
-                bitmapY = static_cast<int>(std::floor(srcPoint.y)) % fBitmap.height();
-                if (bitmapY < 0) bitmapY += fBitmap.height(); 
-                break;
-
-            case GTileMode::kMirror:
-                bitmapX = static_cast<int>(std::floor(srcPoint.x));
-                bitmapY = static_cast<int>(std::floor(srcPoint.y));
-                
-                bitmapX = bitmapX % (2 * fBitmap.width());
-                if (bitmapX < 0) bitmapX += 2 * fBitmap.width();
-                if (bitmapX >= fBitmap.width()) bitmapX = 2 * fBitmap.width() - bitmapX - 1;
-
-                bitmapY = bitmapY % (2 * fBitmap.height());
-                if (bitmapY < 0) bitmapY += 2 * fBitmap.height();
-                if (bitmapY >= fBitmap.height()) bitmapY = 2 * fBitmap.height() - bitmapY - 1;
-                break;
+inline int floor_to_int(float v) {
+    return static_cast<int>(std::floor(v));
+}
+
+// Coordinates further out than this are pinned there (and NaN goes to -kMaxCoord), which keeps
+// the conversions to int defined. Tiling that far out can't be meaningful anyway.
+constexpr float kMaxCoord = 1 << 30;
+
+inline float pin_coord(float v) {
+    return std::fmin(std::fmax(v, -kMaxCoord), kMaxCoord);
+}
+
+// (a * (256 - w) + b * w) / 256 per channel, two channels at a time
+inline GPixel lerp_pixel(GPixel a, GPixel b, unsigned w) {
+    const unsigned iw = 256 - w;
+    const uint32_t rb = (((a & 0xFF00FF) * iw + (b & 0xFF00FF) * w) >> 8) & 0xFF00FF;
+    const uint32_t ag = (((a >> 8) & 0xFF00FF) * iw + ((b >> 8) & 0xFF00FF) * w) & 0xFF00FF00;
+    return rb | ag;
+}
+
+}  // namespace
+
+// The inverse matrix is classified once per draw, and each kind gets its own row kernel:
+//   translate  x maps to x plus a whole number, so rows are copied straight out of the bitmap
+//   scale      x maps independently of y, so the source columns are computed once into a table
+//              that every row reuses
+//   affine     the source point steps by a constant per pixel, tracked in 16.16 fixed point
+//   bilinear   like affine, blending the 4 texels around each point by its fractions
+// The translate and scale kernels do exactly the float math the per-pixel mapping would.
+class BitmapShader::Context : public GShaderContext {
+public:
+    Context(const GBitmap& bitmap, const GMatrix& inverse, GTileMode tileMode, bool bilinear)
+        : fBitmap(bitmap), fInverse(inverse), fTileMode(tileMode) {
+        const bool scaleOnly = inverse[1] == 0 && inverse[2] == 0;
+        if (bilinear) {
+            fKind = kBilinear;
+        } else if (scaleOnly && inverse[0] == 1 && inverse[4] == std::floor(inverse[4]) &&
+                   std::abs(inverse[4]) < (1 << 24)) {
+            fKind = kTranslate;
+            fTranslateX = (int)inverse[4];
+        } else if (scaleOnly) {
+            fKind = kScale;
+        } else {
+            fKind = kAffine;
         }
+    }
+
+    void shadeRow(int x, int y, int count, GPixel row[]) override {
+        with_tile_mode(fTileMode, [&](auto mode) {
+            constexpr GTileMode M = decltype(mode)::value;
+            switch (fKind) {
+                case kTranslate: this->shadeTranslate<M>(x, y, count, row); break;
+                case kScale:     this->shadeScale<M>(x, y, count, row); break;
+                case kAffine:    this->shadeAffine<M>(x, y, count, row); break;
+                case kBilinear:  this->shadeBilinear<M>(x, y, count, row); break;
+            }
+        });
+    }
+
+private:
+    enum Kind { kTranslate, kScale, kAffine, kBilinear };
 
-        if (bitmapX >= 0 && bitmapX < fBitmap.width() && bitmapY >= 0 && bitmapY < fBitmap.height()) {
-            row[i] = *fBitmap.getAddr(bitmapX, bitmapY);
+    // Device columns covered by the scale kernel's table. It starts a little left of the span
+    // that built it (when the span leaves room), so the spans of a polygon's next rows usually
+    // still fall inside.
+    static constexpr int kTableSize = 1024;
+    static constexpr int kTableSlack = 64;
+
+    // Source row for device row y, when the source row doesn't depend on x
+    template <GTileMode M> const GPixel* srcRow(int y) const {
+        const int sy = floor_to_int(fInverse[3] * (y + 0.5f) + fInverse[5]);
+        return fBitmap.getAddr(0, tile<M>(sy, fBitmap.height()));
+    }
+
+    template <GTileMode M> void shadeTranslate(int x, int y, int count, GPixel row[]) {
+        const GPixel* src = this->srcRow<M>(y);
+        const int w = fBitmap.width();
+        const int sx = x + fTranslateX;
+
+        if (M == GTileMode::kClamp) {
+            // Left edge color, the bitmap's own pixels, then the right edge color
+            const int lead = std::clamp(-sx, 0, count);
+            const int body = std::clamp(w - (sx + lead), 0, count - lead);
+            std::fill_n(row, lead, src[0]);
+            if (body > 0) {
+                memcpy(row + lead, src + sx + lead, body * sizeof(GPixel));
+            }
+            std::fill_n(row + lead + body, count - lead - body, src[w - 1]);
+        } else if (M == GTileMode::kRepeat) {
+            for (int i = tile<M>(sx, w); count > 0; i = 0) {
+                const int n = std::min(count, w - i);
+                memcpy(row, src + i, n * sizeof(GPixel));
+                row += n;
+                count -= n;
+            }
         } else {
-            row[i] = GPixel_PackARGB(0, 0, 0, 0);  
+            for (int i = 0; i < count; ++i) {
+                row[i] = src[tile<M>(sx + i, w)];
+            }
+        }
+    }
+
+    template <GTileMode M> void shadeScale(int x, int y, int count, GPixel row[]) {
+        const GPixel* src = this->srcRow<M>(y);
+        while (count > 0) {
+            if (x < fTableLeft || x >= fTableLeft + fTableCount) {
+                this->buildTable<M>(x - std::clamp(kTableSize - count, 0, kTableSlack));
+            }
+            const int* table = fXTable + (x - fTableLeft);
+            const int n = std::min(count, fTableLeft + fTableCount - x);
+            for (int i = 0; i < n; ++i) {
+                row[i] = src[table[i]];
+            }
+            x += n;
+            row += n;
+            count -= n;
+        }
+    }
+
+    template <GTileMode M> void buildTable(int left) {
+        const int w = fBitmap.width();
+        for (int i = 0; i < kTableSize; ++i) {
+            fXTable[i] = tile<M>(floor_to_int(fInverse[0] * (left + i + 0.5f) + fInverse[4]), w);
+        }
+        fTableLeft = left;
+        fTableCount = kTableSize;
+    }
+
+    template <GTileMode M> void shadeAffine(int x, int y, int count, GPixel row[]) {
+        const GPoint start = fInverse * GPoint{x + 0.5f, y + 0.5f};
+        const float endX = start.x + fInverse[0] * count;
+        const float endY = start.y + fInverse[1] * count;
+        const int w = fBitmap.width();
+        const int h = fBitmap.height();
+
+        if (!(std::max({std::abs(start.x), std::abs(start.y), std::abs(endX), std::abs(endY)}) <
+              kMaxCoord)) {
+            // Too far out (or not finite) for fixed point, so map each pixel
+            for (int i = 0; i < count; ++i) {
+                const GPoint p = fInverse * GPoint{x + i + 0.5f, y + 0.5f};
+                row[i] = *fBitmap.getAddr(tile<M>(floor_to_int(pin_coord(p.x)), w),
+                                          tile<M>(floor_to_int(pin_coord(p.y)), h));
+            }
+            return;
+        }
+
+        // 16.16 fixed point, held in 64 bits so the coordinate range above can't overflow
+        int64_t fx = (int64_t)std::floor((double)start.x * 65536);
+        int64_t fy = (int64_t)std::floor((double)start.y * 65536);
+        const int64_t dx = std::llround((double)fInverse[0] * 65536);
+        const int64_t dy = std::llround((double)fInverse[1] * 65536);
+        const GPixel* pixels = fBitmap.pixels();
+        const size_t rowPixels = fBitmap.rowBytes() >> 2;
+        for (int i = 0; i < count; ++i) {
+            const int sx = tile<M>((int)(fx >> 16), w);
+            const int sy = tile<M>((int)(fy >> 16), h);
+            row[i] = pixels[sy * rowPixels + sx];
+            fx += dx;
+            fy += dy;
+        }
+    }
+
+    template <GTileMode M> void shadeBilinear(int x, int y, int count, GPixel row[]) {
+        // Offset by half a texel, so the integer part of a point is its top-left texel and the
+        // fraction is how far it is toward the next one
+        const GPoint start = fInverse * GPoint{x + 0.5f, y + 0.5f} - GPoint{0.5f, 0.5f};
+        const float endX = start.x + fInverse[0] * count;
+        const float endY = start.y + fInverse[1] * count;
+
+        if (!(std::max({std::abs(start.x), std::abs(start.y), std::abs(endX), std::abs(endY)}) <
+              kMaxCoord)) {
+            for (int i = 0; i < count; ++i) {
+                const GPoint p = fInverse * GPoint{x + i + 0.5f, y + 0.5f};
+                row[i] = this->sampleBilinear<M>(
+                        (int64_t)std::floor((double)pin_coord(p.x - 0.5f) * 65536),
+                        (int64_t)std::floor((double)pin_coord(p.y - 0.5f) * 65536));
+            }
+            return;
+        }
+
+        int64_t fx = (int64_t)std::floor((double)start.x * 65536);
+        int64_t fy = (int64_t)std::floor((double)start.y * 65536);
+        const int64_t dx = std::llround((double)fInverse[0] * 65536);
+        const int64_t dy = std::llround((double)fInverse[1] * 65536);
+        if (dy == 0) {
+            // The source rows and their weight are the same for the whole span
+            const int y0 = (int)(fy >> 16);
+            const unsigned wy = (unsigned)(fy >> 8) & 0xFF;
+            const GPixel* r0 = fBitmap.getAddr(0, tile<M>(y0, fBitmap.height()));
+            const GPixel* r1 = fBitmap.getAddr(0, tile<M>(y0 + 1, fBitmap.height()));
+            const int w = fBitmap.width();
+            for (int i = 0; i < count; ++i) {
+                const int x0 = (int)(fx >> 16);
+                const unsigned wx = (unsigned)(fx >> 8) & 0xFF;
+                const int c0 = tile<M>(x0, w);
+                const int c1 = tile<M>(x0 + 1, w);
+                row[i] = lerp_pixel(lerp_pixel(r0[c0], r0[c1], wx), lerp_pixel(r1[c0], r1[c1], wx),
+                                    wy);
+                fx += dx;
+            }
+            return;
+        }
+        for (int i = 0; i < count; ++i) {
+            row[i] = this->sampleBilinear<M>(fx, fy);
+            fx += dx;
+            fy += dy;
+        }
+    }
+
+    // Blend the 4 texels around the 16.16 point (fx, fy), using 8 bits of each fraction
+    template <GTileMode M> GPixel sampleBilinear(int64_t fx, int64_t fy) const {
+        const int x0 = (int)(fx >> 16);
+        const int y0 = (int)(fy >> 16);
+        const unsigned wx = (unsigned)(fx >> 8) & 0xFF;
+        const unsigned wy = (unsigned)(fy >> 8) & 0xFF;
+        const int c0 = tile<M>(x0, fBitmap.width());
+        const int c1 = tile<M>(x0 + 1, fBitmap.width());
+        const GPixel* r0 = fBitmap.getAddr(0, tile<M>(y0, fBitmap.height()));
+        const GPixel* r1 = fBitmap.getAddr(0, tile<M>(y0 + 1, fBitmap.height()));
+        return lerp_pixel(lerp_pixel(r0[c0], r0[c1], wx), lerp_pixel(r1[c0], r1[c1], wx), wy);
+    }
+
+    const GBitmap& fBitmap;
+    GMatrix fInverse;
+    GTileMode fTileMode;
+    Kind fKind;
+    int fTranslateX = 0;
+
+    int fTableLeft = 0;
+    int fTableCount = 0;
+    int fXTable[kTableSize];
+};
+
+const BitmapShader::MipPyramid& BitmapShader::mips() const {
+    std::call_once(fMipsOnce, [this] {
+        int levelCount = 0;
+        for (int w = fBitmap.width(), h = fBitmap.height(); w > 1 || h > 1; ++levelCount) {
+            w = std::max(1, w / 2);
+            h = std::max(1, h / 2);
+        }
+        fMips.levels.reserve(levelCount);
+
+        const GBitmap* src = &fBitmap;
+        for (int level = 0; level < levelCount; ++level) {
+            const int w = std::max(1, src->width() / 2);
+            const int h = std::max(1, src->height() / 2);
+            std::unique_ptr<GPixel[]> pixels(new GPixel[w * h]);
+
+            // Average each 2x2 block (a lone last row or column averages with itself)
+            for (int y = 0; y < h; ++y) {
+                const GPixel* s0 = src->getAddr(0, std::min(2 * y, src->height() - 1));
+                const GPixel* s1 = src->getAddr(0, std::min(2 * y + 1, src->height() - 1));
+                GPixel* dst = pixels.get() + y * w;
+                for (int x = 0; x < w; ++x) {
+                    const int x0 = std::min(2 * x, src->width() - 1);
+                    const int x1 = std::min(2 * x + 1, src->width() - 1);
+                    const GPixel p[4] = {s0[x0], s0[x1], s1[x0], s1[x1]};
+                    unsigned a = 2, r = 2, g = 2, b = 2;
+                    for (GPixel q : p) {
+                        a += GPixel_GetA(q);
+                        r += GPixel_GetR(q);
+                        g += GPixel_GetG(q);
+                        b += GPixel_GetB(q);
+                    }
+                    dst[x] = GPixel_PackARGB(a >> 2, r >> 2, g >> 2, b >> 2);
+                }
+            }
+
+            fMips.levels.emplace_back(w, h, w * sizeof(GPixel), pixels.get(), src->isOpaque());
+            fMips.storage.push_back(std::move(pixels));
+            src = &fMips.levels.back();
+        }
+    });
+    return fMips;
+}
+
+GShaderContext* BitmapShader::makeContext(const GMatrix& ctm, Arena& arena) const {
+    if (fBitmap.width() <= 0 || fBitmap.height() <= 0) {
+        return nullptr;
+    }
+    GMatrix totalMatrix = GMatrix::Concat(ctm, fLocalMatrix);
+    auto invMatrix = totalMatrix.invert();
+    if (!invMatrix) {
+        return nullptr;
+    }
+    GMatrix inverse = *invMatrix;
+    const GBitmap* bitmap = &fBitmap;
+
+    if (fFilter == GFilterQuality::kMipmap) {
+        // Texels per pixel along the most minified axis picks the level: 2 or more means at
+        // least level 1 (half size), 4 or more level 2, ...
+        const float scale = std::max(std::hypot(inverse[0], inverse[1]),
+                                     std::hypot(inverse[2], inverse[3]));
+        if (scale >= 2 && std::isfinite(scale)) {
+            // Level 0 is the bitmap itself, which is all a 1x1 bitmap has
+            const MipPyramid& mips = this->mips();
+            const int level = std::min((int)std::log2(scale), (int)mips.levels.size());
+            if (level > 0) {
+                bitmap = &mips.levels[level - 1];
+                inverse = GMatrix::Concat(
+                        GMatrix::Scale((float)bitmap->width() / fBitmap.width(),
+                                       (float)bitmap->height() / fBitmap.height()),
+                        inverse);
+            }
         }
     }
+
+    // Bilinear sampling of texels that land exactly on pixels is just nearest sampling
+    const bool pixelAligned = inverse[0] == 1 && inverse[1] == 0 && inverse[2] == 0 &&
+                              inverse[3] == 1 && inverse[4] == std::floor(inverse[4]) &&
+                              inverse[5] == std::floor(inverse[5]);
+    const bool bilinear = fFilter != GFilterQuality::kNearest && !pixelAligned;
+    return arena.make<Context>(*bitmap, inverse, fTileMode, bilinear);
 }
 
 
-std::shared_ptr<GShader> GCreateBitmapShader(const GBitmap& bitmap, const GMatrix& localMatrix, GTileMode tileMode) {
-    return std::make_shared<BitmapShader>(bitmap, localMatrix, tileMode);
-}
\ No newline at end of file
+std::shared_ptr<GShader> GCreateBitmapShader(const GBitmap& bitmap, const GMatrix& localMatrix,
+                                             GTileMode tileMode, GFilterQuality filter) {
+    return std::make_shared<BitmapShader>(bitmap, localMatrix, tileMode, filter);
+}
@@ -4,21 +4,42 @@
 #include "./include/GShader.h"
 #include "./include/GBitmap.h"
 #include "./include/GMatrix.h"
+#include <memory>
+#include <mutex>
+#include <vector>
 
 class BitmapShader : public GShader {
 public:
-    BitmapShader(const GBitmap& bitmap, const GMatrix& localMatrix, GTileMode tileMode);
-    bool isOpaque() override;
-    bool setContext(const GMatrix& ctm) override;
-    void shadeRow(int x, int y, int count, GPixel row[]) override;
+    BitmapShader(const GBitmap& bitmap, const GMatrix& localMatrix, GTileMode tileMode,
+                 GFilterQuality filter);
+    bool isOpaque() const override;
+    GShaderContext* makeContext(const GMatrix& ctm, Arena& arena) const override;
 private:
+    friend class PictureFile;
+    class Context;
+
+    // Box-filtered copies of the bitmap, each half the size of the one before, down to 1x1.
+    // levels[0] is the first reduction, not the bitmap itself, so a 1x1 bitmap has none. Each
+    // shader builds its own: its pixels may be redrawn between shaders, and only a shader's
+    // lifetime promises they hold still.
+    struct MipPyramid {
+        std::vector<GBitmap> levels;
+        std::vector<std::unique_ptr<GPixel[]>> storage;
+    };
+    const MipPyramid& mips() const;
+
     GBitmap fBitmap;
-    GMatrix fInverse;
     GMatrix fLocalMatrix;
     bool fOpaque;
     GTileMode fTileMode;
+    GFilterQuality fFilter;
+
+    // Built by the first draw that minifies the bitmap; shaders are shared across threads
+    mutable std::once_flag fMipsOnce;
+    mutable MipPyramid fMips;
 };
 
-std::shared_ptr<GShader> GCreateBitmapShader(const GBitmap& bitmap, const GMatrix& localMatrix, GTileMode tileMode);
+std::shared_ptr<GShader> GCreateBitmapShader(const GBitmap& bitmap, const GMatrix& localMatrix,
+                                             GTileMode tileMode, GFilterQuality filter);
 
-#endif
\ No newline at end of file
+#endif
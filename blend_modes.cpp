@@ -1,9 +1,6 @@
 #include "blend_modes.h"
 #include "./include/GPixel.h"
-
-// Blend function implementations
-#include "blend_modes.h"
-#include "./include/GPixel.h"
+#include "my_utils.h"
 #include <algorithm>  // for std::max and std::min
 
 // Blend function implementations
@@ -36,10 +33,10 @@ GPixel src_over_mode(GPixel src, GPixel dst) {
     int invSrcA = 255 - srcA;
 
     
-    int a = srcA + ((invSrcA * GPixel_GetA(dst)) >> 8);
-    int r = GPixel_GetR(src) + ((invSrcA * GPixel_GetR(dst)) >> 8);
-    int g = GPixel_GetG(src) + ((invSrcA * GPixel_GetG(dst)) >> 8);
-    int b = GPixel_GetB(src) + ((invSrcA * GPixel_GetB(dst)) >> 8);
+    int a = srcA + GDiv255(invSrcA * GPixel_GetA(dst));
+    int r = GPixel_GetR(src) + GDiv255(invSrcA * GPixel_GetR(dst));
+    int g = GPixel_GetG(src) + GDiv255(invSrcA * GPixel_GetG(dst));
+    int b = GPixel_GetB(src) + GDiv255(invSrcA * GPixel_GetB(dst));
     
     return GPixel_PackARGB(a, r, g, b);
 }
@@ -54,10 +51,10 @@ GPixel src_in_mode(GPixel src, GPixel dst) {
     int dstA = GPixel_GetA(dst);
 
     
-    int a = (GPixel_GetA(src) * dstA) >> 8;
-    int r = (GPixel_GetR(src) * dstA) >> 8;
-    int g = (GPixel_GetG(src) * dstA) >> 8;
-    int b = (GPixel_GetB(src) * dstA) >> 8;
+    int a = GDiv255(GPixel_GetA(src) * dstA);
+    int r = GDiv255(GPixel_GetR(src) * dstA);
+    int g = GDiv255(GPixel_GetG(src) * dstA);
+    int b = GDiv255(GPixel_GetB(src) * dstA);
 
     return GPixel_PackARGB(a, r, g, b);
 }
@@ -67,10 +64,10 @@ GPixel dst_in_mode(GPixel src, GPixel dst) {
     int srcA = GPixel_GetA(src);
 
     
-    int a = (GPixel_GetA(dst) * srcA) >> 8;
-    int r = (GPixel_GetR(dst) * srcA) >> 8;
-    int g = (GPixel_GetG(dst) * srcA) >> 8;
-    int b = (GPixel_GetB(dst) * srcA) >> 8;
+    int a = GDiv255(GPixel_GetA(dst) * srcA);
+    int r = GDiv255(GPixel_GetR(dst) * srcA);
+    int g = GDiv255(GPixel_GetG(dst) * srcA);
+    int b = GDiv255(GPixel_GetB(dst) * srcA);
 
     return GPixel_PackARGB(a, r, g, b);
 }
@@ -81,10 +78,10 @@ GPixel src_out_mode(GPixel src, GPixel dst) {
     int invDstA = 255 - dstA;
 
     
-    int a = (GPixel_GetA(src) * invDstA) >> 8;
-    int r = (GPixel_GetR(src) * invDstA) >> 8;
-    int g = (GPixel_GetG(src) * invDstA) >> 8;
-    int b = (GPixel_GetB(src) * invDstA) >> 8;
+    int a = GDiv255(GPixel_GetA(src) * invDstA);
+    int r = GDiv255(GPixel_GetR(src) * invDstA);
+    int g = GDiv255(GPixel_GetG(src) * invDstA);
+    int b = GDiv255(GPixel_GetB(src) * invDstA);
 
     return GPixel_PackARGB(a, r, g, b);
 }
@@ -95,10 +92,10 @@ GPixel dst_out_mode(GPixel src, GPixel dst) {
     int invSrcA = 255 - srcA;
 
     
-    int a = (GPixel_GetA(dst) * invSrcA) >> 8;
-    int r = (GPixel_GetR(dst) * invSrcA) >> 8;
-    int g = (GPixel_GetG(dst) * invSrcA) >> 8;
-    int b = (GPixel_GetB(dst) * invSrcA) >> 8;
+    int a = GDiv255(GPixel_GetA(dst) * invSrcA);
+    int r = GDiv255(GPixel_GetR(dst) * invSrcA);
+    int g = GDiv255(GPixel_GetG(dst) * invSrcA);
+    int b = GDiv255(GPixel_GetB(dst) * invSrcA);
 
     return GPixel_PackARGB(a, r, g, b);
 }
@@ -110,10 +107,10 @@ GPixel src_atop_mode(GPixel src, GPixel dst) {
     int invSrcA = 255 - srcA;
 
     
-    int a = (dstA * srcA + invSrcA * GPixel_GetA(dst)) >> 8;
-    int r = (dstA * GPixel_GetR(src) + invSrcA * GPixel_GetR(dst)) >> 8;
-    int g = (dstA * GPixel_GetG(src) + invSrcA * GPixel_GetG(dst)) >> 8;
-    int b = (dstA * GPixel_GetB(src) + invSrcA * GPixel_GetB(dst)) >> 8;
+    int a = GDiv255(dstA * srcA + invSrcA * GPixel_GetA(dst));
+    int r = GDiv255(dstA * GPixel_GetR(src) + invSrcA * GPixel_GetR(dst));
+    int g = GDiv255(dstA * GPixel_GetG(src) + invSrcA * GPixel_GetG(dst));
+    int b = GDiv255(dstA * GPixel_GetB(src) + invSrcA * GPixel_GetB(dst));
 
     return GPixel_PackARGB(a, r, g, b);
 }
@@ -125,10 +122,10 @@ GPixel dst_atop_mode(GPixel src, GPixel dst) {
     int invDstA = 255 - dstA;
 
     
-    int a = (srcA * dstA + invDstA * GPixel_GetA(src)) >> 8;
-    int r = (srcA * GPixel_GetR(dst) + invDstA * GPixel_GetR(src)) >> 8;
-    int g = (srcA * GPixel_GetG(dst) + invDstA * GPixel_GetG(src)) >> 8;
-    int b = (srcA * GPixel_GetB(dst) + invDstA * GPixel_GetB(src)) >> 8;
+    int a = GDiv255(srcA * dstA + invDstA * GPixel_GetA(src));
+    int r = GDiv255(srcA * GPixel_GetR(dst) + invDstA * GPixel_GetR(src));
+    int g = GDiv255(srcA * GPixel_GetG(dst) + invDstA * GPixel_GetG(src));
+    int b = GDiv255(srcA * GPixel_GetB(dst) + invDstA * GPixel_GetB(src));
 
     return GPixel_PackARGB(a, r, g, b);
 }
@@ -141,10 +138,10 @@ GPixel xor_mode(GPixel src, GPixel dst) {
     int invDstA = 255 - dstA;
 
         
-    int a = (invSrcA * dstA + invDstA * srcA) >> 8;
-    int r = (invSrcA * GPixel_GetR(dst) + invDstA * GPixel_GetR(src)) >> 8;
-    int g = (invSrcA * GPixel_GetG(dst) + invDstA * GPixel_GetG(src)) >> 8;
-    int b = (invSrcA * GPixel_GetB(dst) + invDstA * GPixel_GetB(src)) >> 8;
+    int a = GDiv255(invSrcA * dstA + invDstA * srcA);
+    int r = GDiv255(invSrcA * GPixel_GetR(dst) + invDstA * GPixel_GetR(src));
+    int g = GDiv255(invSrcA * GPixel_GetG(dst) + invDstA * GPixel_GetG(src));
+    int b = GDiv255(invSrcA * GPixel_GetB(dst) + invDstA * GPixel_GetB(src));
 
     return GPixel_PackARGB(a, r, g, b);
 }
@@ -164,3 +161,186 @@ const BlendProc gProcs[] = {
     dst_atop_mode, // kDstATop
     xor_mode       // kXor
 };
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+// Row blend functions
+//
+// Each mode is written once against a small set of vector helpers operating on pixels that
+// have been widened to 16 bits per channel (b, g, r, a lanes), so the same expression serves
+// the SSE2 (2 pixels per register) and AVX2 (4 pixels per register) paths. Leftover pixels,
+// and every pixel on targets without SSE2, go through the scalar procs above.
+
+namespace {
+
+#if defined(__SSE2__)
+static inline __m128i vadd(__m128i a, __m128i b) { return _mm_add_epi16(a, b); }
+static inline __m128i vmul(__m128i a, __m128i b) { return _mm_mullo_epi16(a, b); }
+static inline __m128i vdiv(__m128i x) { return GDiv255(x); }
+static inline __m128i vinv(__m128i x) { return _mm_sub_epi16(_mm_set1_epi16(255), x); }
+static inline __m128i vzero(__m128i) { return _mm_setzero_si128(); }
+static inline __m128i valpha(__m128i x) {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xFF), 0xFF);
+}
+#endif
+
+#if defined(__AVX2__)
+static inline __m256i vadd(__m256i a, __m256i b) { return _mm256_add_epi16(a, b); }
+static inline __m256i vmul(__m256i a, __m256i b) { return _mm256_mullo_epi16(a, b); }
+static inline __m256i vdiv(__m256i x) { return GDiv255(x); }
+static inline __m256i vinv(__m256i x) { return _mm256_sub_epi16(_mm256_set1_epi16(255), x); }
+static inline __m256i vzero(__m256i) { return _mm256_setzero_si256(); }
+static inline __m256i valpha(__m256i x) {
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, 0xFF), 0xFF);
+}
+#endif
+
+// Each mode provides Vec() on widened vectors and Scalar() for single pixels
+struct ClearMode {
+    template <typename V> static V Vec(V s, V d) { return vzero(s); }
+    static GPixel Scalar(GPixel s, GPixel d) { return clear_mode(s, d); }
+};
+struct SrcMode {
+    template <typename V> static V Vec(V s, V d) { return s; }
+    static GPixel Scalar(GPixel s, GPixel d) { return src_mode(s, d); }
+};
+struct DstMode {
+    template <typename V> static V Vec(V s, V d) { return d; }
+    static GPixel Scalar(GPixel s, GPixel d) { return dst_mode(s, d); }
+};
+struct SrcOverMode {
+    template <typename V> static V Vec(V s, V d) {
+        return vadd(s, vdiv(vmul(vinv(valpha(s)), d)));
+    }
+    static GPixel Scalar(GPixel s, GPixel d) { return src_over_mode(s, d); }
+};
+struct DstOverMode {
+    template <typename V> static V Vec(V s, V d) { return SrcOverMode::Vec(d, s); }
+    static GPixel Scalar(GPixel s, GPixel d) { return dst_over_mode(s, d); }
+};
+struct SrcInMode {
+    template <typename V> static V Vec(V s, V d) { return vdiv(vmul(s, valpha(d))); }
+    static GPixel Scalar(GPixel s, GPixel d) { return src_in_mode(s, d); }
+};
+struct DstInMode {
+    template <typename V> static V Vec(V s, V d) { return vdiv(vmul(d, valpha(s))); }
+    static GPixel Scalar(GPixel s, GPixel d) { return dst_in_mode(s, d); }
+};
+struct SrcOutMode {
+    template <typename V> static V Vec(V s, V d) { return vdiv(vmul(s, vinv(valpha(d)))); }
+    static GPixel Scalar(GPixel s, GPixel d) { return src_out_mode(s, d); }
+};
+struct DstOutMode {
+    template <typename V> static V Vec(V s, V d) { return vdiv(vmul(d, vinv(valpha(s)))); }
+    static GPixel Scalar(GPixel s, GPixel d) { return dst_out_mode(s, d); }
+};
+// The two-product modes cannot overflow 16 bits for premultiplied inputs, since each
+// channel is bounded by its alpha (e.g. Da*S + (1-Sa)*D <= Da*Sa + (1-Sa)*Da = 255*Da)
+struct SrcATopMode {
+    template <typename V> static V Vec(V s, V d) {
+        return vdiv(vadd(vmul(s, valpha(d)), vmul(d, vinv(valpha(s)))));
+    }
+    static GPixel Scalar(GPixel s, GPixel d) { return src_atop_mode(s, d); }
+};
+struct DstATopMode {
+    template <typename V> static V Vec(V s, V d) { return SrcATopMode::Vec(d, s); }
+    static GPixel Scalar(GPixel s, GPixel d) { return dst_atop_mode(s, d); }
+};
+struct XorMode {
+    template <typename V> static V Vec(V s, V d) {
+        return vdiv(vadd(vmul(d, vinv(valpha(s))), vmul(s, vinv(valpha(d)))));
+    }
+    static GPixel Scalar(GPixel s, GPixel d) { return xor_mode(s, d); }
+};
+
+// Widen 4 (SSE2) or 8 (AVX2) pixels into two vectors of 16-bit lanes, blend, and narrow
+#if defined(__SSE2__)
+template <typename Mode> static inline __m128i blend4(__m128i s, __m128i d) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = Mode::Vec(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+    __m128i hi = Mode::Vec(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+    return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+#if defined(__AVX2__)
+template <typename Mode> static inline __m256i blend8(__m256i s, __m256i d) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo = Mode::Vec(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+    __m256i hi = Mode::Vec(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+    return _mm256_packus_epi16(lo, hi);
+}
+#endif
+
+template <typename Mode> void blend_row(GPixel dst[], const GPixel src[], int n) {
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), blend8<Mode>(s, d));
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), blend4<Mode>(s, d));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = Mode::Scalar(src[i], dst[i]);
+    }
+}
+
+template <typename Mode> void blend_row_const(GPixel dst[], GPixel src, int n) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i s8 = _mm256_set1_epi32((int)src);
+    for (; i + 8 <= n; i += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), blend8<Mode>(s8, d));
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i s4 = _mm_set1_epi32((int)src);
+    for (; i + 4 <= n; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), blend4<Mode>(s4, d));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = Mode::Scalar(src, dst[i]);
+    }
+}
+
+}  // namespace
+
+const BlendRowProc gRowProcs[] = {
+    blend_row<ClearMode>,    // kClear
+    blend_row<SrcMode>,      // kSrc
+    blend_row<DstMode>,      // kDst
+    blend_row<SrcOverMode>,  // kSrcOver
+    blend_row<DstOverMode>,  // kDstOver
+    blend_row<SrcInMode>,    // kSrcIn
+    blend_row<DstInMode>,    // kDstIn
+    blend_row<SrcOutMode>,   // kSrcOut
+    blend_row<DstOutMode>,   // kDstOut
+    blend_row<SrcATopMode>,  // kSrcATop
+    blend_row<DstATopMode>,  // kDstATop
+    blend_row<XorMode>       // kXor
+};
+
+const BlendConstRowProc gConstRowProcs[] = {
+    blend_row_const<ClearMode>,    // kClear
+    blend_row_const<SrcMode>,      // kSrc
+    blend_row_const<DstMode>,      // kDst
+    blend_row_const<SrcOverMode>,  // kSrcOver
+    blend_row_const<DstOverMode>,  // kDstOver
+    blend_row_const<SrcInMode>,    // kSrcIn
+    blend_row_const<DstInMode>,    // kDstIn
+    blend_row_const<SrcOutMode>,   // kSrcOut
+    blend_row_const<DstOutMode>,   // kDstOut
+    blend_row_const<SrcATopMode>,  // kSrcATop
+    blend_row_const<DstATopMode>,  // kDstATop
+    blend_row_const<XorMode>       // kXor
+};
@@ -24,4 +24,14 @@ GPixel xor_mode(GPixel src, GPixel dst);
 // Lookup table of blend functions
 extern const BlendProc gProcs[];
 
+// Row-level blend functions: blend n src pixels into dst, or one constant src pixel into
+// n dst pixels. These process several pixels per iteration with SIMD where available, so
+// callers should pick one per draw and use it for whole spans.
+typedef void (*BlendRowProc)(GPixel dst[], const GPixel src[], int n);
+typedef void (*BlendConstRowProc)(GPixel dst[], GPixel src, int n);
+
+// Lookup tables of row blend functions, indexed by GBlendMode
+extern const BlendRowProc gRowProcs[];
+extern const BlendConstRowProc gConstRowProcs[];
+
 #endif  // BLEND_MODES_H
\ No newline at end of file
@@ -0,0 +1,170 @@
+#include "blitter.h"
+#include "my_utils.h"
+#include <algorithm>
+
+// Rewrites mode into the cheapest mode with the same result, given what is known up front
+// about the source and destination alpha. Returns false if the draw cannot change the
+// destination at all.
+static bool reduce_blend_mode(GBlendMode& mode, bool srcOpaque, bool srcTransparent,
+                              bool dstOpaque) {
+    // A rewrite can enable another (e.g. kXor -> kSrcOut -> kClear), so iterate until stable
+    for (;;) {
+        GBlendMode reduced = mode;
+        if (srcTransparent) {
+            switch (mode) {
+                case GBlendMode::kSrcOver:
+                case GBlendMode::kDstOver:
+                case GBlendMode::kDstOut:
+                case GBlendMode::kSrcATop:
+                case GBlendMode::kXor:      reduced = GBlendMode::kDst; break;
+                case GBlendMode::kSrc:
+                case GBlendMode::kSrcIn:
+                case GBlendMode::kDstIn:
+                case GBlendMode::kSrcOut:
+                case GBlendMode::kDstATop:  reduced = GBlendMode::kClear; break;
+                default: break;
+            }
+        }
+        if (srcOpaque) {
+            switch (mode) {
+                case GBlendMode::kSrcOver:  reduced = GBlendMode::kSrc; break;
+                case GBlendMode::kDstIn:    reduced = GBlendMode::kDst; break;
+                case GBlendMode::kDstOut:   reduced = GBlendMode::kClear; break;
+                case GBlendMode::kSrcATop:  reduced = GBlendMode::kSrcIn; break;
+                case GBlendMode::kDstATop:  reduced = GBlendMode::kDstOver; break;
+                case GBlendMode::kXor:      reduced = GBlendMode::kSrcOut; break;
+                default: break;
+            }
+        }
+        if (dstOpaque && reduced == mode) {
+            switch (mode) {
+                case GBlendMode::kDstOver:  reduced = GBlendMode::kDst; break;
+                case GBlendMode::kSrcIn:    reduced = GBlendMode::kSrc; break;
+                case GBlendMode::kSrcOut:   reduced = GBlendMode::kClear; break;
+                case GBlendMode::kSrcATop:  reduced = GBlendMode::kSrcOver; break;
+                case GBlendMode::kDstATop:  reduced = GBlendMode::kDstIn; break;
+                case GBlendMode::kXor:      reduced = GBlendMode::kDstOut; break;
+                default: break;
+            }
+        }
+        if (reduced == mode) {
+            return mode != GBlendMode::kDst;
+        }
+        mode = reduced;
+    }
+}
+
+Blitter::Blitter(const GBitmap& device, const GPaint& paint, const GMatrix& ctm, bool dstOpaque,
+                 ShadeScratch& scratch, Arena& arena)
+    : fDevice(device), fScratch(scratch), fShader(nullptr), fSrcPixel(0) {
+    const GShader* shader = paint.peekShader();
+    if (shader) {
+        fShader = shader->makeContext(ctm, arena);
+    }
+    bool srcOpaque;
+    bool srcTransparent = false;
+    if (fShader) {
+        srcOpaque = shader->isOpaque();
+    } else {
+        // No shader (or the shader rejected the CTM), fall back to the paint's color
+        fSrcPixel = GColorToPixel(paint.getColor());
+        srcOpaque = GPixel_GetA(fSrcPixel) == 255;
+        srcTransparent = GPixel_GetA(fSrcPixel) == 0;
+    }
+
+    GBlendMode mode = paint.getBlendMode();
+    fNoop = !reduce_blend_mode(mode, srcOpaque, srcTransparent, dstOpaque);
+    fPreservesOpaque = dstOpaque && (fNoop || mode == GBlendMode::kSrcOver ||
+                                     (mode == GBlendMode::kSrc && srcOpaque));
+
+    if (mode == GBlendMode::kClear) {
+        // The result does not depend on the source, so fill with transparent
+        fShader = nullptr;
+        fSrcPixel = 0;
+        mode = GBlendMode::kSrc;
+    }
+
+    fRowProc = gRowProcs[static_cast<int>(mode)];
+    fConstRowProc = gConstRowProcs[static_cast<int>(mode)];
+
+    if (fNoop) {
+        fBlitH = &Blitter::blitNothing;
+    } else if (fShader) {
+        // In kSrc the shader overwrites the destination, so it can shade straight into it
+        fBlitH = mode == GBlendMode::kSrc ? &Blitter::blitShaderDirect : &Blitter::blitShader;
+    } else {
+        fBlitH = mode == GBlendMode::kSrc ? &Blitter::blitFill : &Blitter::blitSolid;
+    }
+}
+
+Blitter::Blitter(const GBitmap& device, GBlendMode mode, bool srcOpaque, bool dstOpaque,
+                 ShadeScratch& scratch)
+    : fDevice(device), fScratch(scratch), fShader(nullptr), fSrcPixel(0) {
+    fNoop = !reduce_blend_mode(mode, srcOpaque, false, dstOpaque);
+    fPreservesOpaque = dstOpaque && (fNoop || mode == GBlendMode::kSrcOver ||
+                                     (mode == GBlendMode::kSrc && srcOpaque));
+    fRowProc = gRowProcs[static_cast<int>(mode)];
+    fConstRowProc = gConstRowProcs[static_cast<int>(mode)];
+    fBlitH = &Blitter::blitNothing;
+}
+
+// Mix dst toward src by coverage / 255
+static inline GPixel lerp(GPixel dst, GPixel src, unsigned coverage) {
+    const unsigned inv = 255 - coverage;
+    return GPixel_PackARGB(GDiv255(GPixel_GetA(src) * coverage + GPixel_GetA(dst) * inv),
+                           GDiv255(GPixel_GetR(src) * coverage + GPixel_GetR(dst) * inv),
+                           GDiv255(GPixel_GetG(src) * coverage + GPixel_GetG(dst) * inv),
+                           GDiv255(GPixel_GetB(src) * coverage + GPixel_GetB(dst) * inv));
+}
+
+// Blend as if fully covered, then lerp with coverage, which is right for every blend mode
+void Blitter::blitAntiH(int x, int y, int width, const uint8_t coverage[]) {
+    if (fNoop) {
+        return;
+    }
+    GPixel* dst = fDevice.getAddr(x, y);
+    GPixel* blended = fScratch.tmp;
+    while (width > 0) {
+        const int n = std::min(width, kShadeChunk);
+        std::copy_n(dst, n, blended);
+        if (fShader) {
+            fShader->shadeRow(x, y, n, fScratch.src);
+            fRowProc(blended, fScratch.src, n);
+        } else {
+            fConstRowProc(blended, fSrcPixel, n);
+        }
+        for (int i = 0; i < n; ++i) {
+            dst[i] = lerp(dst[i], blended[i], coverage[i]);
+        }
+        x += n;
+        dst += n;
+        coverage += n;
+        width -= n;
+    }
+}
+
+void Blitter::blitNothing(int x, int y, int width) {}
+
+void Blitter::blitFill(int x, int y, int width) {
+    std::fill_n(fDevice.getAddr(x, y), width, fSrcPixel);
+}
+
+void Blitter::blitSolid(int x, int y, int width) {
+    fConstRowProc(fDevice.getAddr(x, y), fSrcPixel, width);
+}
+
+void Blitter::blitShader(int x, int y, int width) {
+    GPixel* dst = fDevice.getAddr(x, y);
+    while (width > 0) {
+        const int n = std::min(width, kShadeChunk);
+        fShader->shadeRow(x, y, n, fScratch.src);
+        fRowProc(dst, fScratch.src, n);
+        x += n;
+        dst += n;
+        width -= n;
+    }
+}
+
+void Blitter::blitShaderDirect(int x, int y, int width) {
+    fShader->shadeRow(x, y, width, fDevice.getAddr(x, y));
+}
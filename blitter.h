@@ -0,0 +1,82 @@
+#ifndef BLITTER_H
+#define BLITTER_H
+
+#include "./include/GBitmap.h"
+#include "./include/GMatrix.h"
+#include "./include/GPaint.h"
+#include "./include/GShader.h"
+#include "blend_modes.h"
+#include "my_utils.h"
+#include "arena.h"
+
+// Scratch rows for shading and blending, owned by the canvas and reused by every draw
+struct ShadeScratch {
+    alignas(64) GPixel src[kShadeChunk];
+    alignas(64) GPixel tmp[kShadeChunk];
+};
+
+// Writes spans of a paint into the device. A Blitter is built once per draw, so the shader
+// context (allocated in the draw's arena), the blend proc and the solid color are resolved
+// once instead of for every span. Setup also rewrites the blend mode into the cheapest
+// equivalent given the source and destination opacity, so a draw may become a no-op, a fill,
+// or a shader writing straight into the device. Callers are responsible for clipping spans to
+// the device.
+class Blitter {
+public:
+    // dstOpaque promises that every device pixel currently has alpha 255
+    Blitter(const GBitmap& device, const GPaint& paint, const GMatrix& ctm, bool dstOpaque,
+            ShadeScratch& scratch, Arena& arena);
+
+    // Blitter for a source the caller computes itself and passes to blitRow(). srcOpaque
+    // promises that every source pixel will have alpha 255.
+    Blitter(const GBitmap& device, GBlendMode mode, bool srcOpaque, bool dstOpaque,
+            ShadeScratch& scratch);
+
+    // True if the draw cannot change any device pixel, so callers can skip it entirely
+    bool isNoop() const { return fNoop; }
+
+    // True if an opaque device is still opaque after this draw
+    bool preservesOpaque() const { return fPreservesOpaque; }
+
+    // Blend the paint into [x, x + width) on row y
+    void blitH(int x, int y, int width) {
+        (this->*fBlitH)(x, y, width);
+    }
+
+    // Blend src[0..width) into [x, x + width) on row y, for blitters made without a paint
+    void blitRow(int x, int y, int width, const GPixel src[]) {
+        if (!fNoop) {
+            fRowProc(fDevice.getAddr(x, y), src, width);
+        }
+    }
+
+    // Blend the paint into [x, x + width) on row y, where each pixel is only partially covered:
+    // the blended result is mixed with the existing pixel by coverage[i] / 255
+    void blitAntiH(int x, int y, int width, const uint8_t coverage[]);
+
+    // Blend the paint into the rectangle [x, x + width) x [y, y + height)
+    void blitRect(int x, int y, int width, int height) {
+        for (int i = 0; i < height; ++i) {
+            (this->*fBlitH)(x, y + i, width);
+        }
+    }
+
+private:
+    void blitNothing(int x, int y, int width);
+    void blitFill(int x, int y, int width);
+    void blitSolid(int x, int y, int width);
+    void blitShader(int x, int y, int width);
+    void blitShaderDirect(int x, int y, int width);
+
+    const GBitmap& fDevice;
+    ShadeScratch& fScratch;
+    GShaderContext* fShader;
+    GPixel fSrcPixel;
+    bool fNoop;
+    bool fPreservesOpaque;
+    BlendRowProc fRowProc;
+    BlendConstRowProc fConstRowProc;
+    void (Blitter::*fBlitH)(int x, int y, int width);
+};
+
+#endif
@@ -2,35 +2,62 @@
 #define COMPOSITE_SHADER_H
 
 #include "./include/GShader.h"
+#include "my_utils.h"
+#include "arena.h"
+#include <algorithm>
 
 class CompositeShader : public GShader {
 public:
     CompositeShader(std::shared_ptr<GShader> s1, std::shared_ptr<GShader> s2)
     : shader1(s1), shader2(s2) {}
 
-    bool isOpaque() override {
+    bool isOpaque() const override {
         return shader1->isOpaque() && shader2->isOpaque();
     }
-    bool setContext(const GMatrix& ctm) override {
-        return shader1->setContext(ctm) && shader2->setContext(ctm);
-    }
-    void shadeRow(int x, int y, int count, GPixel row[]) override {
-        GPixel row1[count], row2[count];
-        shader1->shadeRow(x, y, count, row1);
-        shader2->shadeRow(x, y, count, row2);
-
-        for (int i = 0; i < count; ++i) {
-            int a = GPixel_GetA(row1[i]) * GPixel_GetA(row2[i]) / 255;
-            int r = GPixel_GetR(row1[i]) * GPixel_GetR(row2[i]) / 255;
-            int g = GPixel_GetG(row1[i]) * GPixel_GetG(row2[i]) / 255;
-            int b = GPixel_GetB(row1[i]) * GPixel_GetB(row2[i]) / 255;
-            row[i] = GPixel_PackARGB(a, r, g, b);
+    GShaderContext* makeContext(const GMatrix& ctm, Arena& arena) const override {
+        GShaderContext* context1 = shader1->makeContext(ctm, arena);
+        GShaderContext* context2 = shader2->makeContext(ctm, arena);
+        if (!context1 || !context2) {
+            return nullptr;
         }
+        return arena.make<Context>(context1, context2);
     }
 
 private:
+    class Context : public GShaderContext {
+    public:
+        Context(GShaderContext* context1, GShaderContext* context2)
+            : fContext1(context1), fContext2(context2) {}
+
+        void shadeRow(int x, int y, int count, GPixel row[]) override;
+
+    private:
+        GShaderContext* fContext1;
+        GShaderContext* fContext2;
+    };
+
     std::shared_ptr<GShader> shader1;
     std::shared_ptr<GShader> shader2;
 };
 
+inline void CompositeShader::Context::shadeRow(int x, int y, int count, GPixel row[]) {
+    // The first shader writes straight into row, the second a chunk at a time beside it
+    fContext1->shadeRow(x, y, count, row);
+
+    alignas(64) GPixel row2[kShadeChunk];
+    for (int start = 0; start < count; start += kShadeChunk) {
+        const int n = std::min(count - start, kShadeChunk);
+        fContext2->shadeRow(x + start, y, n, row2);
+
+        GPixel* row1 = row + start;
+        for (int i = 0; i < n; ++i) {
+            int a = GDiv255(GPixel_GetA(row1[i]) * GPixel_GetA(row2[i]));
+            int r = GDiv255(GPixel_GetR(row1[i]) * GPixel_GetR(row2[i]));
+            int g = GDiv255(GPixel_GetG(row1[i]) * GPixel_GetG(row2[i]));
+            int b = GDiv255(GPixel_GetB(row1[i]) * GPixel_GetB(row2[i]));
+            row1[i] = GPixel_PackARGB(a, r, g, b);
+        }
+    }
+}
+
 #endif
@@ -0,0 +1,45 @@
+#include "gradient_lut.h"
+#include "my_utils.h"
+
+GradientLUT::GradientLUT(const GColor colors[], const float pos[], int count, int size)
+    : fPixels(size), fScale(static_cast<float>(size - 1)), fOpaque(true) {
+    for (int i = 0; i < count; ++i) {
+        fOpaque &= colors[i].a >= 1.0f;
+    }
+    if (count == 1) {
+        std::fill(fPixels.begin(), fPixels.end(), GColorToPixel(colors[0]));
+        return;
+    }
+
+    // Walk the color intervals alongside the samples, since both increase with t
+    int lower = 0;
+    for (int i = 0; i < size; ++i) {
+        const float t = i / fScale;
+        float blend;
+        if (pos) {
+            while (lower < count - 2 && pos[lower + 1] < t) {
+                lower += 1;
+            }
+            const float span = pos[lower + 1] - pos[lower];
+            blend = span > 0 ? (t - pos[lower]) / span : 0;
+        } else {
+            const float scaled = t * (count - 1);
+            lower = std::min(static_cast<int>(scaled), count - 2);
+            blend = scaled - lower;
+        }
+
+        const GColor& c0 = colors[lower];
+        const GColor& c1 = colors[lower + 1];
+        fPixels[i] = GColorToPixel({c0.r + blend * (c1.r - c0.r),
+                                    c0.g + blend * (c1.g - c0.g),
+                                    c0.b + blend * (c1.b - c0.b),
+                                    c0.a + blend * (c1.a - c0.a)});
+    }
+}
+
+int GradientLUT::SizeFor(int count, float length) {
+    // A ramp from 0 to 255 in one channel between every pair of colors, but no finer than the
+    // gradient's length in pixels
+    const float steps = std::min(255.0f * std::max(count - 1, 1), length);
+    return steps < 256 ? 256 : 1024;
+}
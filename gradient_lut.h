@@ -0,0 +1,34 @@
+#ifndef GRADIENT_LUT_H
+#define GRADIENT_LUT_H
+
+#include "./include/GColor.h"
+#include "./include/GPixel.h"
+#include <algorithm>
+#include <vector>
+
+// A gradient's premultiplied colors sampled at evenly spaced t in [0, 1]. Gradients build one
+// when they are created, so shading a pixel is computing its t and indexing the table.
+class GradientLUT {
+public:
+    // Colors evenly spaced over [0, 1] when pos is null, else at the increasing positions pos[]
+    GradientLUT(const GColor colors[], const float pos[], int count, int size);
+
+    // Entries for a gradient of count colors that spans length pixels: enough that neighbouring
+    // entries differ by about one 8-bit step at most
+    static int SizeFor(int count, float length);
+
+    // t is pinned to [0, 1] (NaN reads the first entry)
+    GPixel lookup(float t) const {
+        const float f = t * fScale + 0.5f;
+        return fPixels[f > 0 ? static_cast<int>(std::min(f, fScale)) : 0];
+    }
+
+    bool isOpaque() const { return fOpaque; }
+
+private:
+    std::vector<GPixel> fPixels;
+    float fScale;  // fPixels.size() - 1
+    bool fOpaque;
+};
+
+#endif
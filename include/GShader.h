@@ -10,6 +10,7 @@
 #include "GPixel.h"
 #include "GPoint.h"
 
+class Arena;
 class GBitmap;
 class GMatrix;
 
@@ -19,25 +20,56 @@ enum class GTileMode {
     kMirror,
 };
 
+/**
+ *  How a bitmap shader samples its bitmap.
+ *    kNearest   the texel under each pixel center
+ *    kBilinear  the 4 texels around each pixel center, weighted by distance
+ *    kMipmap    bilinear, from a box-filtered copy of the bitmap scaled down to roughly match
+ *               the draw (built the first time a minified draw needs it)
+ */
+enum class GFilterQuality {
+    kNearest,
+    kBilinear,
+    kMipmap,
+};
+
+/**
+ *  The state a shader needs to shade one draw: its inverse matrix and anything else it can
+ *  precompute for the draw's CTM. Contexts live in the draw's arena, which never runs
+ *  destructors, so they must be trivially destructible.
+ */
+class GShaderContext {
+public:
+    /**
+     *  Given a row of pixels in device space [x, y] ... [x + count - 1, y], return the
+     *  corresponding src pixels in row[0...count - 1]. The caller must ensure that row[]
+     *  can hold at least [count] entries.
+     */
+    virtual void shadeRow(int x, int y, int count, GPixel row[]) = 0;
+
+protected:
+    ~GShaderContext() = default;
+};
+
 /**
  *  GShaders create colors to fill whatever geometry is being drawn to a GCanvas.
+ *
+ *  A shader is an immutable description. Everything that depends on the CTM lives in the
+ *  GShaderContext each draw makes, so one shader can be used by many canvases and threads
+ *  at once.
  */
 class GShader : public std::enable_shared_from_this<GShader> {
 public:
     virtual ~GShader() {}
 
     // Return true iff all of the GPixels that may be returned by this shader will be opaque.
-    virtual bool isOpaque() = 0;
-
-    // The draw calls in GCanvas must call this with the CTM before any calls to shadeSpan().
-    virtual bool setContext(const GMatrix& ctm) = 0;
+    virtual bool isOpaque() const = 0;
 
     /**
-     *  Given a row of pixels in device space [x, y] ... [x + count - 1, y], return the
-     *  corresponding src pixels in row[0...count - 1]. The caller must ensure that row[]
-     *  can hold at least [count] entries.
+     *  Return a context, allocated in arena, that shades for a draw with this CTM. Returns
+     *  null if the shader can't draw with it (e.g. the CTM isn't invertible).
      */
-    virtual void shadeRow(int x, int y, int count, GPixel row[]) = 0;
+    virtual GShaderContext* makeContext(const GMatrix& ctm, Arena& arena) const = 0;
 };
 
 /**
@@ -45,7 +77,8 @@ public:
  *  Returns null if the subclass can not be created.
  */
 std::shared_ptr<GShader> GCreateBitmapShader(const GBitmap&, const GMatrix& localMatrix,
-                                             GTileMode = GTileMode::kClamp);
+                                             GTileMode = GTileMode::kClamp,
+                                             GFilterQuality = GFilterQuality::kNearest);
 
 /**
  *  Return a subclass of GShader that draws the specified gradient of [count] colors between
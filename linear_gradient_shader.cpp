@@ -3,7 +3,8 @@
 
 
 LinearGradientShader::LinearGradientShader(GPoint p0, GPoint p1, const GColor colors[], int count, GTileMode tileMode)
-    : fP0(p0), fP1(p1), fCount(count), fTileMode(tileMode) {
+    : fP0(p0), fP1(p1), fCount(count), fTileMode(tileMode),
+      fLUT(colors, nullptr, count, GradientLUT::SizeFor(count, std::hypot(p1.x - p0.x, p1.y - p0.y))) {
     fColors = new GColor[fCount];
     for (int i = 0; i < fCount; ++i) {
         fColors[i] = colors[i];
@@ -14,16 +15,24 @@ LinearGradientShader::~LinearGradientShader() {
     delete[] fColors;  // Release dynamically allocated memory
 }
 
-bool LinearGradientShader::isOpaque() {
-    for (int i = 0; i < fCount; ++i) {
-        if (fColors[i].a != 1.0f) {
-            return false;
-        }
-    }
-    return true;
+bool LinearGradientShader::isOpaque() const {
+    return fLUT.isOpaque();
 }
 
-bool LinearGradientShader::setContext(const GMatrix& ctm) {
+class LinearGradientShader::Context : public GShaderContext {
+public:
+    Context(const LinearGradientShader& shader, const GMatrix& inverse)
+        : fLUT(shader.fLUT), fTileMode(shader.fTileMode), fInverseMatrix(inverse) {}
+
+    void shadeRow(int x, int y, int count, GPixel row[]) override;
+
+private:
+    const GradientLUT& fLUT;
+    GTileMode fTileMode;
+    GMatrix fInverseMatrix;
+};
+
+GShaderContext* LinearGradientShader::makeContext(const GMatrix& ctm, Arena& arena) const {
     // Calculate the transformation matrix
     float dx = fP1.x - fP0.x;
     float dy = fP1.y - fP0.y;
@@ -32,47 +41,40 @@ bool LinearGradientShader::setContext(const GMatrix& ctm) {
     GMatrix gradientMatrix = GMatrix(dx, -dy, fP0.x,
                                      dy,  dx, fP0.y);
 
-    fTotalMatrix = GMatrix::Concat(ctm, gradientMatrix);
-    
-
-    auto inv = fTotalMatrix.invert();
+    auto inv = GMatrix::Concat(ctm, gradientMatrix).invert();
     if (!inv) {
-        return false; 
+        return nullptr;
     }
-    fInverseMatrix = *inv; 
-    return true;
+    return arena.make<Context>(*this, *inv);
 }
 
-void LinearGradientShader::shadeRow(int x, int y, int count, GPixel row[]) {
-    for (int i = 0; i < count; ++i) {
-        GPoint src = { x + i + 0.5f, y + 0.5f };
-        fInverseMatrix.mapPoints(&src, &src, 1);
-       
-        float t = src.x;
-        switch (fTileMode) {
-            case GTileMode::kClamp:
-                t = std::clamp(t, 0.0f, 1.0f);
-                break;
-            case GTileMode::kRepeat:
-                t -= std::floor(t);
-                break;
-            case GTileMode::kMirror:
-                t = std::fabs(std::fmod(t, 2.0f));
-                t = (t > 1) ? (2 - t) : t;
-                break;
-        }
-
-        float scaledT = t * (fCount - 1);
-        int index = std::min(static_cast<int>(scaledT), fCount - 2);
-        float localT = scaledT - index;
+void LinearGradientShader::Context::shadeRow(int x, int y, int count, GPixel row[]) {
+    // t is the x of the pixel center in gradient space, which steps by a constant along the row
+    const GMatrix& inv = fInverseMatrix;
+    const float t0 = inv[0] * (x + 0.5f) + inv[2] * (y + 0.5f) + inv[4];
+    const float dt = inv[0];
 
-        GColor interpolatedColor = {
-            fColors[index].r + localT * (fColors[index + 1].r - fColors[index].r),
-            fColors[index].g + localT * (fColors[index + 1].g - fColors[index].g),
-            fColors[index].b + localT * (fColors[index + 1].b - fColors[index].b),
-            fColors[index].a + localT * (fColors[index + 1].a - fColors[index].a)
-        };
-        row[i] = GColorToPixel(interpolatedColor);
+    switch (fTileMode) {
+        case GTileMode::kClamp:
+            // The lookup pins t
+            for (int i = 0; i < count; ++i) {
+                row[i] = fLUT.lookup(t0 + i * dt);
+            }
+            break;
+        case GTileMode::kRepeat:
+            for (int i = 0; i < count; ++i) {
+                const float t = t0 + i * dt;
+                row[i] = fLUT.lookup(t - std::floor(t));
+            }
+            break;
+        case GTileMode::kMirror:
+            // Repeat with period 2, then reflect the second half (cheaper than fmod)
+            for (int i = 0; i < count; ++i) {
+                const float u = (t0 + i * dt) * 0.5f;
+                const float t = 2 * (u - std::floor(u));
+                row[i] = fLUT.lookup(t > 1 ? 2 - t : t);
+            }
+            break;
     }
 }
 
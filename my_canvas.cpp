@@ -1,7 +1,10 @@
 #include "my_canvas.h"
 #include "my_utils.h"
-#include "blend_modes.h"
+#include "blitter.h"
 #include "my_gpath.h"
+#include "path_cache.h"
+#include "GPicture.h"
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include <iostream>
@@ -9,43 +12,13 @@
 
 using namespace std;
 
-GPixel Blend(GPixel src, GPixel dst, GBlendMode mode) {
-    int srcA = GPixel_GetA(src);  // Get source alpha channel
-
-    // Handle source blending modes
-    if (mode == GBlendMode::kSrc) {
-        return src;  // In kSrc mode, source completely replaces destination
-    } 
-    else if (mode == GBlendMode::kSrcOver) {
-        if (srcA == 255) {
-            return src;  // Fully opaque source, just return it
-        } else if (srcA == 0) {
-            return dst;  // Fully transparent source, just return destination
-        } else {
-            // Blend source over destination
-            int invSrcA = 255 - srcA;  
-            int a = srcA + ((invSrcA * GPixel_GetA(dst)) >> 8);  
-            int r = GPixel_GetR(src) + ((invSrcA * GPixel_GetR(dst)) >> 8);  
-            int g = GPixel_GetG(src) + ((invSrcA * GPixel_GetG(dst)) >> 8);  
-            int b = GPixel_GetB(src) + ((invSrcA * GPixel_GetB(dst)) >> 8);  
-            return GPixel_PackARGB(a, r, g, b);  
-        }
-    }
-    // For all other blend modes
-    return gProcs[static_cast<int>(mode)](src, dst);
-}
-
-
-
-
-// Clears the entire canvas with the given color
+// Clears the entire canvas (within the clip) with the given color
 void MyCanvas::clear(const GColor& color) {
     GPixel pixel = GColorToPixel(color);
-    GPixel* row = fDevice.pixels();
-    size_t totalPixels = fDevice.height() * fDevice.width();
+    fDeviceOpaque = GPixel_GetA(pixel) == 255;
 
-    for (size_t i = 0; i < totalPixels; ++i) {
-        row[i] = pixel;
+    for (int y = fClip.top; y < fClip.bottom; ++y) {
+        std::fill_n(fDevice.getAddr(fClip.left, y), fClip.width(), pixel);
     }
 }
 
@@ -68,9 +41,7 @@ void MyCanvas::concat(const GMatrix& matrix) {
 
 
 void MyCanvas::drawRect(const GRect& rect, const GPaint& paint) {
-    GShader* shader = paint.peekShader();
-    GBlendMode mode = paint.getBlendMode();
-
+    Arena::Scope scope(fArena);
     // First, convert the rectangle into its 4 corner points
     GPoint corners[4] = {
         {rect.left, rect.top},
@@ -94,52 +65,134 @@ void MyCanvas::drawRect(const GRect& rect, const GPaint& paint) {
         maxY = std::max(maxY, transformedCorners[i].y);
     }
 
-    // Clip the bounding box to the canvas size
-    int left = std::max(GRoundToInt(minX), 0);
-    int right = std::min(GRoundToInt(maxX), fDevice.width());
-    int top = std::max(GRoundToInt(minY), 0);
-    int bottom = std::min(GRoundToInt(maxY), fDevice.height());
+    // Anti-aliasing only matters if the edges aren't on pixel boundaries
+    if (paint.isAntiAlias()) {
+        const bool axisAligned = fCTM[1] == 0 && fCTM[2] == 0;
+        if (!axisAligned || minX != std::floor(minX) || maxX != std::floor(maxX) ||
+            minY != std::floor(minY) || maxY != std::floor(maxY)) {
+            this->drawConvexPolygon(corners, 4, paint);
+            return;
+        }
+    }
+
+    // Clip the bounding box to the clip
+    int left = std::max(GRoundToInt(minX), fClip.left);
+    int right = std::min(GRoundToInt(maxX), fClip.right);
+    int top = std::max(GRoundToInt(minY), fClip.top);
+    int bottom = std::min(GRoundToInt(maxY), fClip.bottom);
     if (left >= right || top >= bottom) {
         return; // The rect is fully clipped, no need to draw
     }
 
-    if (shader && shader->setContext(fCTM)) {
+    Blitter blitter(fDevice, paint, fCTM, fDeviceOpaque, fScratch, fArena);
+    if (blitter.isNoop()) {
+        return;
+    }
+    fDeviceOpaque = blitter.preservesOpaque();
+    blitter.blitRect(left, top, right - left, bottom - top);
+}
 
-        // If there is a shader, shade each row with the shader
-        for (int y = top; y < bottom; ++y) {
-            GPixel rowPixels[right - left];
-            shader->shadeRow(left, y, right - left, rowPixels);
-            GPixel* dstRow = fDevice.getAddr(left, y);
-            for (int x = 0; x < right - left; ++x) {
-                dstRow[x] = Blend(rowPixels[x], dstRow[x], mode);
-            }
+
+
+// Calls span(x, y, width) for each row of the device-space polygon pts inside clip. Rows are
+// sampled at their centers, as drawPath's edges are, and span ends are rounded.
+//
+// Convex polygons (and any outline that only turns around in y at its top and bottom) cross
+// each row exactly twice, so this walks a left and a right chain of edges down from the top
+// vertex instead of intersecting every edge with every row. Returns false without calling
+// span if pts is not such an outline, or is not finite.
+template <typename Span>
+static bool scan_convex(const GPoint pts[], int count, const GIRect& clip, Span&& span) {
+    int topIndex = 0, bottomIndex = 0;
+    float minX = pts[0].x, maxX = pts[0].x;
+    int turns = 0, firstDir = 0, lastDir = 0;
+    for (int i = 0; i < count; ++i) {
+        const GPoint& p = pts[i];
+        if (!std::isfinite(p.x) || !std::isfinite(p.y)) {
+            return false;
         }
-    } else {
-        // Fallback to solid color drawing if there is no shader
-        GColor color = paint.getColor();
-        GPixel srcPixel = GColorToPixel(color);
-
-        for (int y = top; y < bottom; ++y) {
-            GPixel* dstRow = fDevice.getAddr(left, y);
-            for (int x = left; x < right; ++x) {
-                dstRow[x - left] = Blend(srcPixel, dstRow[x - left], mode);
-            }
+        topIndex = p.y < pts[topIndex].y ? i : topIndex;
+        bottomIndex = p.y > pts[bottomIndex].y ? i : bottomIndex;
+        minX = std::min(minX, p.x);
+        maxX = std::max(maxX, p.x);
+
+        const float dy = pts[i + 1 < count ? i + 1 : 0].y - p.y;
+        const int dir = dy > 0 ? 1 : (dy < 0 ? -1 : 0);
+        if (dir) {
+            turns += lastDir && dir != lastDir;
+            firstDir = firstDir ? firstDir : dir;
+            lastDir = dir;
         }
     }
-}
+    turns += lastDir != firstDir;
+    if (turns > 2) {
+        return false;
+    }
 
+    const GPoint& topPt = pts[topIndex];
+    const GPoint& bottomPt = pts[bottomIndex];
+    const int top = std::max(GRoundToInt(topPt.y), clip.top);
+    const int bottom = std::min(GRoundToInt(bottomPt.y), clip.bottom);
+    const int left = std::max(GRoundToInt(minX), clip.left);
+    const int right = std::min(GRoundToInt(maxX), clip.right);
+    if (top >= bottom || left >= right) {
+        return true;
+    }
 
+    // Each chain is at the edge from pts[index] to the next vertex in its direction, which
+    // covers rows [pts[index].y, next.y). Chains only move down, and stop short of the bottom.
+    struct Chain {
+        int index, step;
+        float slope;
+        bool ready;
+    };
+    Chain chains[2] = {{topIndex, 1, 0, false}, {topIndex, count - 1, 0, false}};
+    auto settle = [&](Chain& chain, float y) {
+        int next = (chain.index + chain.step) % count;
+        if (chain.ready && pts[next].y > y) {
+            return;
+        }
+        while (pts[next].y <= y) {
+            chain.index = next;
+            next = (next + chain.step) % count;
+        }
+        const GPoint& p0 = pts[chain.index];
+        const GPoint& p1 = pts[next];
+        chain.slope = (p1.x - p0.x) / (p1.y - p0.y);
+        chain.ready = true;
+    };
+
+    for (int y = top; y < bottom; ++y) {
+        const float center = y + 0.5f;
+        if (center < topPt.y || center >= bottomPt.y) {
+            continue;  // Rounding can reach a row no edge crosses
+        }
+        float x[2];
+        for (int i = 0; i < 2; ++i) {
+            settle(chains[i], center);
+            const GPoint& p0 = pts[chains[i].index];
+            x[i] = p0.x + (center - p0.y) * chains[i].slope;
+        }
+        int startX = std::max(GRoundToInt(std::min(x[0], x[1])), left);
+        int endX = std::min(GRoundToInt(std::max(x[0], x[1])), right);
+        if (startX < endX) {
+            span(startX, y, endX - startX);
+        }
+    }
+    return true;
+}
 
 void MyCanvas::drawConvexPolygon(const GPoint pts[], int count, const GPaint& paint) {
     if (count < 3) {
         return;  // A valid polygon must have at least 3 vertices
     }
-
-    GShader* shader = paint.peekShader();
-    GBlendMode mode = paint.getBlendMode();
+    Arena::Scope scope(fArena);
 
     // First, transform all the points by the CTM
-    GPoint transformedPts[count];
+    if (fDevicePts.size() < (size_t)count) {
+        fDevicePts.resize(count);
+    }
+    GPoint* transformedPts = fDevicePts.data();
     fCTM.mapPoints(transformedPts, pts, count);
     
     // Calculate the bounding box of the transformed points
@@ -153,36 +206,57 @@ void MyCanvas::drawConvexPolygon(const GPoint pts[], int count, const GPaint& pa
         maxY = std::max(maxY, transformedPts[i].y);
     }
 
-    // Clip the bounding box to the canvas size
-    int left = std::max(GRoundToInt(minX), 0);
-    int right = std::min(GRoundToInt(maxX), fDevice.width());
-    int top = std::max(GRoundToInt(minY), 0);
-    int bottom = std::min(GRoundToInt(maxY), fDevice.height());
+    // Clip the bounding box to the clip
+    int left = std::max(GRoundToInt(minX), fClip.left);
+    int right = std::min(GRoundToInt(maxX), fClip.right);
+    int top = std::max(GRoundToInt(minY), fClip.top);
+    int bottom = std::min(GRoundToInt(maxY), fClip.bottom);
 
     if (left >= right || top >= bottom) {
         return;  // The polygon is fully clipped, no need to draw
     }
 
-    std::vector<float> intersections(count);
+    Blitter blitter(fDevice, paint, fCTM, fDeviceOpaque, fScratch, fArena);
+    if (blitter.isNoop()) {
+        return;
+    }
+    fDeviceOpaque = blitter.preservesOpaque();
+    if (paint.isAntiAlias()) {
+        GPoint* segments = fArena.makeArray<GPoint>(count * 2);
+        for (int i = 0; i < count; ++i) {
+            segments[2 * i] = transformedPts[i];
+            segments[2 * i + 1] = transformedPts[(i + 1) % count];
+        }
+        renderCoverage(segments, count * 2, blitter);
+        return;
+    }
+    if (scan_convex(transformedPts, count, fClip,
+                    [&](int x, int y, int w) { blitter.blitH(x, y, w); })) {
+        return;
+    }
+
+    // Not actually convex: intersect every edge with each scanline and fill between pairs
+    float* intersections = fArena.makeArray<float>(count);
 
     for (int y = top; y < bottom; ++y) {
+        const float center = y + 0.5f;
         int intersectionCount = 0;
 
-        // Calculate all intersection points on the scanline
+        // Calculate all intersection points on the scanline's center
         for (int i = 0; i < count; ++i) {
             int next = (i + 1) % count;
             GPoint p0 = transformedPts[i];
             GPoint p1 = transformedPts[next];
 
-            if ((p0.y <= y && p1.y > y) || (p1.y <= y && p0.y > y)) {
-                float t = (y - p0.y) / (p1.y - p0.y);
+            if ((p0.y <= center && p1.y > center) || (p1.y <= center && p0.y > center)) {
+                float t = (center - p0.y) / (p1.y - p0.y);
                 float x = p0.x + t * (p1.x - p0.x);
                 intersections[intersectionCount++] = x;
             }
         }
 
         // Sort the intersection points
-        std::sort(intersections.begin(), intersections.begin() + intersectionCount);
+        std::sort(intersections, intersections + intersectionCount);
 
         // Fill the pixels between pairs of intersections
         for (int i = 0; i < intersectionCount; i += 2) {
@@ -195,88 +269,171 @@ void MyCanvas::drawConvexPolygon(const GPoint pts[], int count, const GPaint& pa
                 continue;
             }
 
-            GPixel* row = fDevice.getAddr(startX, y);
-            if (shader && shader->setContext(fCTM)) {
-                // Shader shading for the polygon
-                GPixel rowPixels[endX - startX];
-                shader->shadeRow(startX, y, endX - startX, rowPixels);
-                for (int x = 0; x < endX - startX; ++x) {
-                    row[x] = Blend(rowPixels[x], row[x], mode);
-                }
-            } else {
-                // Fallback to solid color blending
-                GColor color = paint.getColor();
-                GPixel srcPixel = GColorToPixel(color);
-                for (int x = startX; x < endX; ++x) {
-                    row[x - startX] = Blend(srcPixel, row[x - startX], mode);
-                }
-            }
+            blitter.blitH(startX, y, endX - startX);
         }
     }
 }
 
+// Multiply each channel of row by tex, as the texture and vertex colors combine in drawMesh
+static void modulate_row(GPixel row[], const GPixel tex[], int count) {
+    for (int i = 0; i < count; ++i) {
+        int a = GDiv255(GPixel_GetA(row[i]) * GPixel_GetA(tex[i]));
+        int r = GDiv255(GPixel_GetR(row[i]) * GPixel_GetR(tex[i]));
+        int g = GDiv255(GPixel_GetG(row[i]) * GPixel_GetG(tex[i]));
+        int b = GDiv255(GPixel_GetB(row[i]) * GPixel_GetB(tex[i]));
+        row[i] = GPixel_PackARGB(a, r, g, b);
+    }
+}
+
+// Triangles are scan converted directly. Vertices are mapped to device space once, colors are
+// interpolated by stepping their per-pixel delta along each span, and textures make a shader
+// context per triangle in the arena, rewound after each one, so nothing is allocated from the
+// heap once fDevicePts has grown.
 void MyCanvas::drawMesh(const GPoint verts[], const GColor colors[], const GPoint texs[],
                         int count, const int indices[], const GPaint& paint) {
-    for (int i = 0; i < count; ++i) {
-        int index0 = indices[3 * i + 0];
-        int index1 = indices[3 * i + 1];
-        int index2 = indices[3 * i + 2];
-
-        GPoint p0 = verts[index0];
-        GPoint p1 = verts[index1];
-        GPoint p2 = verts[index2];
-
-        std::shared_ptr<GShader> shader;
-        std::shared_ptr<GShader> shaderPtr(paint.peekShader(), [](GShader*) {});  // Wrap shaderPtr
-
-        if (colors && !texs) {
-            // Only color shader
-            shader = std::make_shared<MyTriColorShader>(p0, p1, p2, colors[index0], colors[index1], colors[index2]);
-        } else if (texs && !colors && shaderPtr) {
-            // Only texture shader with ProxyShader for coordinate transformation
-            GMatrix P = compute_basis(p0, p1, p2);
-            GMatrix T = compute_basis(texs[index0], texs[index1], texs[index2]);
-            auto invT = T.invert();  // Obtain the inverse matrix directly
-
-            if (invT) {
-                GMatrix textureToDrawing = GMatrix::Concat(P, *invT);
-                shader = std::make_shared<ProxyShader>(shaderPtr, textureToDrawing);
+    if (count <= 0) {
+        return;
+    }
+    Arena::Scope scope(fArena);
+    const GShader* shader = texs ? paint.peekShader() : nullptr;
+
+    int vertCount = 0;
+    for (int i = 0; i < count * 3; ++i) {
+        vertCount = std::max(vertCount, indices[i] + 1);
+    }
+    if (fDevicePts.size() < (size_t)vertCount) {
+        fDevicePts.resize(vertCount);
+    }
+    GPoint* devPts = fDevicePts.data();
+    fCTM.mapPoints(devPts, verts, vertCount);
+
+    auto triangle = [&](int i, GPoint tri[3]) {
+        tri[0] = devPts[indices[3 * i + 0]];
+        tri[1] = devPts[indices[3 * i + 1]];
+        tri[2] = devPts[indices[3 * i + 2]];
+    };
+    // Maps texture coordinates to the triangle's local coordinates, or false if degenerate
+    auto texToLocal = [&](int i, GMatrix* matrix) {
+        const int i0 = indices[3 * i + 0], i1 = indices[3 * i + 1], i2 = indices[3 * i + 2];
+        auto invT = compute_basis(texs[i0], texs[i1], texs[i2]).invert();
+        if (!invT) {
+            return false;
+        }
+        *matrix = GMatrix::Concat(compute_basis(verts[i0], verts[i1], verts[i2]), *invT);
+        return true;
+    };
+
+    if (!colors) {
+        if (!shader) {
+            // Just the paint, so every triangle blits the same way
+            Blitter blitter(fDevice, paint, fCTM, fDeviceOpaque, fScratch, fArena);
+            if (blitter.isNoop()) {
+                return;
             }
-        } else if (colors && texs) {
-            // Composite shader for both color and texture
-            auto colorShader = std::make_shared<MyTriColorShader>(p0, p1, p2, colors[index0], colors[index1], colors[index2]);
-            GMatrix P = compute_basis(p0, p1, p2);
-            GMatrix T = compute_basis(texs[index0], texs[index1], texs[index2]);
-            auto invT = T.invert();
-
-            if (invT) {
-                GMatrix textureToDrawing = GMatrix::Concat(P, *invT);
-                shader = std::make_shared<CompositeShader>(
-                    std::make_shared<ProxyShader>(shaderPtr, textureToDrawing), colorShader
-                );
+            fDeviceOpaque = blitter.preservesOpaque();
+            for (int i = 0; i < count; ++i) {
+                GPoint tri[3];
+                triangle(i, tri);
+                scan_convex(tri, 3, fClip, [&](int x, int y, int w) { blitter.blitH(x, y, w); });
             }
+            return;
         }
 
-        
-        GPaint trianglePaint = paint;
-        if (shader) {
-            trianglePaint.setShader(shader);
+        // Texture only: the paint's shader, mapped onto each triangle
+        for (int i = 0; i < count; ++i) {
+            Arena::Rewind rewind(fArena);
+            GMatrix texMatrix;
+            if (!texToLocal(i, &texMatrix)) {
+                continue;
+            }
+            Blitter blitter(fDevice, paint, GMatrix::Concat(fCTM, texMatrix), fDeviceOpaque,
+                            fScratch, fArena);
+            if (blitter.isNoop()) {
+                continue;
+            }
+            fDeviceOpaque = blitter.preservesOpaque();
+            GPoint tri[3];
+            triangle(i, tri);
+            scan_convex(tri, 3, fClip, [&](int x, int y, int w) { blitter.blitH(x, y, w); });
+        }
+        return;
+    }
+
+    // Vertex colors, optionally modulated by the texture
+    bool srcOpaque = !shader || shader->isOpaque();
+    for (int i = 0; i < count * 3 && srcOpaque; ++i) {
+        srcOpaque = colors[indices[i]].a >= 1;
+    }
+    Blitter blitter(fDevice, paint.getBlendMode(), srcOpaque, fDeviceOpaque, fScratch);
+    if (blitter.isNoop()) {
+        return;
+    }
+    fDeviceOpaque = blitter.preservesOpaque();
+
+    for (int i = 0; i < count; ++i) {
+        Arena::Rewind rewind(fArena);
+        GPoint tri[3];
+        triangle(i, tri);
+        // Barycentric (u, v) of a device point, and the color delta for one step in x
+        auto inverse = compute_basis(tri[0], tri[1], tri[2]).invert();
+        if (!inverse) {
+            continue;
+        }
+        GMatrix texMatrix;
+        GShaderContext* texContext = nullptr;
+        if (shader && (!texToLocal(i, &texMatrix) ||
+                       !(texContext = shader->makeContext(GMatrix::Concat(fCTM, texMatrix),
+                                                          fArena)))) {
+            continue;
         }
-        GPoint trianglePts[3] = {p0, p1, p2};
-        drawConvexPolygon(trianglePts, 3, trianglePaint);
+        const GColor c0 = colors[indices[3 * i + 0]];
+        const GColor dcdu = colors[indices[3 * i + 1]] - c0;
+        const GColor dcdv = colors[indices[3 * i + 2]] - c0;
+        const GColor dcdx = dcdu * (*inverse)[0] + dcdv * (*inverse)[1];
+
+        scan_convex(tri, 3, fClip, [&](int x, int y, int w) {
+            GPoint uv = *inverse * GPoint{x + 0.5f, y + 0.5f};
+            GColor color = c0 + dcdu * uv.x + dcdv * uv.y;
+            while (w > 0) {
+                const int n = std::min(w, kShadeChunk);
+                GPixel* row = fScratch.src;
+                for (int j = 0; j < n; ++j) {
+                    row[j] = GColorToPixel(color);
+                    color += dcdx;
+                }
+                if (texContext) {
+                    texContext->shadeRow(x, y, n, fScratch.tmp);
+                    modulate_row(row, fScratch.tmp, n);
+                }
+                blitter.blitRow(x, y, n, row);
+                x += n;
+                w -= n;
+            }
+        });
     }
 }
 
 void MyCanvas::drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4],
                         int level, const GPaint& paint) {
-    std::vector<GPoint> quadVerts;
-    std::vector<GColor> quadColors;
-    std::vector<GPoint> quadTexs;
-    std::vector<int> indices;
+    // Negative levels have no triangles. Finer levels than a picture can hold are pinned to the
+    // finest it can, so drawing a quad directly and replaying it from a picture match.
+    if (level < 0) {
+        return;
+    }
+    level = std::min(level, GPicture::kMaxQuadLevel);
+    Arena::Scope scope(fArena);
 
     int gridSize = level + 1;
     float step = 1.0f / gridSize;
 
+    const int vertCount = (gridSize + 1) * (gridSize + 1);
+    GPoint* quadVerts = fArena.makeArray<GPoint>(vertCount);
+    GColor* quadColors = colors ? fArena.makeArray<GColor>(vertCount) : nullptr;
+    GPoint* quadTexs = texs ? fArena.makeArray<GPoint>(vertCount) : nullptr;
+    int* indices = fArena.makeArray<int>(gridSize * gridSize * 6);
+    int vertIndex = 0;
+    int indexCount = 0;
+
     // Generate vertices with bilinear interpolation
     for (int i = 0; i <= gridSize; ++i) {
         for (int j = 0; j <= gridSize; ++j) {
@@ -287,14 +444,14 @@ void MyCanvas::drawQuad(const GPoint verts[4], const GColor colors[4], const GPo
                             verts[1] * u * (1 - v) +
                             verts[2] * u * v +
                             verts[3] * (1 - u) * v;
-            quadVerts.push_back(vertex);
+            quadVerts[vertIndex] = vertex;
 
             if (colors) {
                 GColor color = colors[0] * (1 - u) * (1 - v) +
                                colors[1] * u * (1 - v) +
                                colors[2] * u * v +
                                colors[3] * (1 - u) * v;
-                quadColors.push_back(color);
+                quadColors[vertIndex] = color;
             }
 
             if (texs) {
@@ -302,8 +459,9 @@ void MyCanvas::drawQuad(const GPoint verts[4], const GColor colors[4], const GPo
                                   texs[1] * u * (1 - v) +
                                   texs[2] * u * v +
                                   texs[3] * (1 - u) * v;
-                quadTexs.push_back(texCoord);
+                quadTexs[vertIndex] = texCoord;
             }
+            vertIndex += 1;
         }
     }
 
@@ -315,173 +473,586 @@ void MyCanvas::drawQuad(const GPoint verts[4], const GColor colors[4], const GPo
             int idx2 = idx0 + gridSize + 1;
             int idx3 = idx2 + 1;
 
-            indices.push_back(idx0);
-            indices.push_back(idx1);
-            indices.push_back(idx2);
+            indices[indexCount++] = idx0;
+            indices[indexCount++] = idx1;
+            indices[indexCount++] = idx2;
 
-            indices.push_back(idx1);
-            indices.push_back(idx3);
-            indices.push_back(idx2);
+            indices[indexCount++] = idx1;
+            indices[indexCount++] = idx3;
+            indices[indexCount++] = idx2;
         }
     }
 
     // Call drawMesh with generated data
-    drawMesh(quadVerts.data(),
-             colors ? quadColors.data() : nullptr,
-             texs ? quadTexs.data() : nullptr,
-             indices.size() / 3,
-             indices.data(),
-             paint);
+    drawMesh(quadVerts, quadColors, quadTexs, indexCount / 3, indices, paint);
 }
 
 
-void MyCanvas::blit(int x, int y, int width, const GPaint& paint) {
-    if (x < 0 || x >= fDevice.width()) {
-        return;  // Out of bounds check
+static GRect point_bounds(const GPoint pts[], int count) {
+    GRect bounds = GRect::LTRB(pts[0].x, pts[0].y, pts[0].x, pts[0].y);
+    for (int i = 1; i < count; ++i) {
+        bounds.left = std::min(bounds.left, pts[i].x);
+        bounds.top = std::min(bounds.top, pts[i].y);
+        bounds.right = std::max(bounds.right, pts[i].x);
+        bounds.bottom = std::max(bounds.bottom, pts[i].y);
     }
-    
-    // Clip the width to the canvas bounds
-    width = std::min(width, fDevice.width() - x);
+    return bounds;
+}
 
-    GPixel* row = fDevice.getAddr(x, y);
+// Add a connected piece of the path (a verb, or a run of segments) that goes from first to last
+// within the device-space bounds to segments if the clip makes it trivial, returning false when
+// it still has to be added itself. A piece that is all above or below the clip can't reach its
+// rows. One that is all left or right of it only adds winding to the pixels on its right, so a
+// vertical line at that side of the clip between the same ends does the same, as long as its
+// contour is closed (drawPath closes them all).
+static bool cull_to_clip(const GRect& bounds, GPoint first, GPoint last, const GIRect& clip,
+                         ArenaVector<GPoint>& segments) {
+    if (bounds.bottom <= clip.top || bounds.top >= clip.bottom) {
+        return true;
+    }
+    if (bounds.right <= clip.left || bounds.left >= clip.right) {
+        const float x = bounds.right <= clip.left ? clip.left : clip.right;
+        segments.push_back({x, first.y});
+        segments.push_back({x, last.y});
+        return true;
+    }
+    return false;
+}
 
-    GShader* shader = paint.peekShader();
-    GBlendMode mode = paint.getBlendMode();  
+// Approximate quadratic and cubic curves using line segments with flattening
+void MyCanvas::drawPath(const GPath& path, const GPaint& paint) {
+    // Skip paths whose (mapped) control points are all outside the clip
+    const GRect bounds = path.bounds();
+    GPoint corners[4] = {{bounds.left, bounds.top}, {bounds.right, bounds.top},
+                         {bounds.right, bounds.bottom}, {bounds.left, bounds.bottom}};
+    fCTM.mapPoints(corners, corners, 4);
+    if (std::all_of(corners, corners + 4, [&](GPoint p) { return p.x <= fClip.left; }) ||
+        std::all_of(corners, corners + 4, [&](GPoint p) { return p.x >= fClip.right; }) ||
+        std::all_of(corners, corners + 4, [&](GPoint p) { return p.y <= fClip.top; }) ||
+        std::all_of(corners, corners + 4, [&](GPoint p) { return p.y >= fClip.bottom; })) {
+        return;
+    }
 
-    if (shader && shader->setContext(fCTM)) {
-        // Use shader if available
-        GPixel rowPixels[width];
-        shader->shadeRow(x, y, width, rowPixels);
+    Arena::Scope scope(fArena);
+    Blitter blitter(fDevice, paint, fCTM, fDeviceOpaque, fScratch, fArena);
+    if (blitter.isNoop()) {
+        return;
+    }
+    fDeviceOpaque = blitter.preservesOpaque();
 
-        // Blend each pixel using the shader
-        for (int i = 0; i < width; ++i) {
-            row[i] = Blend(rowPixels[i], row[i], mode);
+    GPoint pts[GPath::kMaxNextPoints];
+    ArenaVector<GPoint> segments(fArena);
+    const float tolerance = 0.25;  // 1/4 pixel tolerance
+
+    // Shared paths that fit in a couple of devices are flattened whole, under the CTM less its
+    // translation, and cached. Drawing one again under a translated CTM (panning, or the next
+    // tile of a threaded canvas) only adds the translation to its segments. Larger paths are
+    // only flattened where the clip can see them.
+    const GRect deviceBounds = point_bounds(corners, 4);
+    const bool cacheable = deviceBounds.width() <= 2 * fDevice.width() &&
+                           deviceBounds.height() <= 2 * fDevice.height() &&
+                           !path.weak_from_this().expired();
+    std::shared_ptr<const PathCache::Segments> flattened;
+    if (cacheable) {
+        flattened = PathCache::Find(path, fCTM);
+    }
+
+    if (!flattened) {
+        const GMatrix matrix = cacheable ? GMatrix(fCTM[0], fCTM[2], 0, fCTM[1], fCTM[3], 0) : fCTM;
+
+        // Curves are mapped before they're flattened (affine maps keep them curves of the same
+        // degree), so the tolerance is in device pixels whatever the scale
+        auto addVerb = [&](GPathVerb verb, GPoint vpts[]) {
+            const int ptCount = verb == GPathVerb::kLine ? 2 : verb == GPathVerb::kQuad ? 3 : 4;
+            matrix.mapPoints(vpts, vpts, ptCount);
+            if (!cacheable && cull_to_clip(point_bounds(vpts, ptCount), vpts[0],
+                                           vpts[ptCount - 1], fClip, segments)) {
+                return;
+            }
+
+            if (verb == GPathVerb::kLine) {
+                segments.push_back(vpts[0]);
+                segments.push_back(vpts[1]);
+            } else if (verb == GPathVerb::kQuad) {
+                flattenQuadratic(vpts, segments, tolerance);
+            } else if (verb == GPathVerb::kCubic) {
+                flattenCubic(vpts, segments, tolerance);
+            }
+        };
+
+        // Every contour is closed with a line back to its start. (The Edger only closes the last
+        // contour, and those that end in a line.) Culling swaps pieces of a contour for lines
+        // with the same winding, which is only the same fill when the contour is closed.
+        GPath::Iter iter(path);
+        GPoint start, last;
+        bool open = false;
+        auto closeContour = [&]() {
+            if (open) {
+                GPoint close[2] = {last, start};
+                addVerb(GPathVerb::kLine, close);
+                open = false;
+            }
+        };
+        while (auto v = iter.next(pts)) {
+            if (*v == GPathVerb::kMove) {
+                closeContour();
+                start = pts[0];
+                continue;
+            }
+            last = pts[*v == GPathVerb::kLine ? 1 : *v == GPathVerb::kQuad ? 2 : 3];
+            open = true;
+            addVerb(*v, pts);
         }
-    } else {
-        // No shader, use solid color
-        GPixel srcPixel = GColorToPixel(paint.getColor());
-        for (int i = 0; i < width; ++i) {
-            row[i] = Blend(srcPixel, row[i], mode);
+        closeContour();
+    }
+
+    if (cacheable) {
+        if (!flattened) {
+            flattened = std::make_shared<PathCache::Segments>(segments.data(), segments.size());
+            PathCache::Add(path, fCTM, flattened);
+            segments.clear();
+        }
+
+        // Runs are culled like verbs, and copied with the translation when the clip sees them
+        const GVector translate = {fCTM[4], fCTM[5]};
+        const GPoint* points = flattened->points.data();
+        size_t start = 0;
+        for (const PathCache::Segments::Run& run : flattened->runs) {
+            const GRect bounds = run.bounds.offset(translate.x, translate.y);
+            if (!cull_to_clip(bounds, points[start] + translate, points[run.end - 1] + translate,
+                              fClip, segments)) {
+                for (size_t i = start; i < run.end; ++i) {
+                    segments.push_back(points[i] + translate);
+                }
+            }
+            start = run.end;
         }
     }
-}
 
-// Approximate quadratic and cubic curves using line segments with flattening
-void MyCanvas::drawPath(const GPath& path, const GPaint& paint) {
-    GPath::Edger edger(path);
-    GPoint pts[4];
-    std::vector<Edge> edges;
-    const float tolerance = 0.25;  // 1/4 pixel tolerance
+    if (paint.isAntiAlias()) {
+        renderCoverage(segments.data(), (int)segments.size(), blitter);
+        return;
+    }
+
+    // Edges are fixed point, so they're kept to the clip's columns: the parts of a segment left or
+    // right of the clip become vertical edges on that side, which wind the pixels inside it the
+    // same way (as in cull_to_clip), and the segment keeps the scanlines in between
+    Edge* edges = fArena.makeArray<Edge>(segments.size() / 2 * 3);
+    int edgeCount = 0;
     int yMin = INT_MAX, yMax = INT_MIN;
+    auto addEdge = [&](GPoint p0, GPoint p1, int firstRow, int lastRow) {
+        Edge edge(p0, p1, std::max(firstRow, fClip.top), std::min(lastRow, fClip.bottom));
+        if (!edge.isEmpty()) {
+            edges[edgeCount++] = edge;
+            yMin = std::min(yMin, edge.top);
+            yMax = std::max(yMax, edge.bottom);
+        }
+    };
+    const float left = fClip.left, right = fClip.right;
+    for (size_t i = 0; i < segments.size(); i += 2) {
+        const GPoint a = segments[i], b = segments[i + 1];
+        if (std::max(a.x, b.x) <= left || std::min(a.x, b.x) >= right) {
+            const float x = std::max(a.x, b.x) <= left ? left : right;
+            addEdge({x, a.y}, {x, b.y}, INT_MIN, INT_MAX);
+            continue;
+        }
 
-    while (auto v = edger.next(pts)) {
-        if (*v == GPathVerb::kLine) {
-            addLineSegment(pts[0], pts[1], edges, yMin, yMax);
-        } else if (*v == GPathVerb::kQuad) {
-            flattenQuadratic(pts, edges, tolerance, yMin, yMax);
-        } else if (*v == GPathVerb::kCubic) {
-            flattenCubic(pts, edges, tolerance, yMin, yMax);
+        // Where the segment enters and leaves the clip's columns
+        float ya = a.y, yb = b.y;
+        if (a.x < left || a.x > right) {
+            const float x = a.x < left ? left : right;
+            ya = a.y + (x - a.x) * (b.y - a.y) / (b.x - a.x);
+            addEdge({x, a.y}, {x, ya}, INT_MIN, INT_MAX);
+        }
+        if (b.x < left || b.x > right) {
+            const float x = b.x < left ? left : right;
+            yb = a.y + (x - a.x) * (b.y - a.y) / (b.x - a.x);
+            addEdge({x, yb}, {x, b.y}, INT_MIN, INT_MAX);
         }
+        addEdge(a, b, Edge::Row(std::min(ya, yb)), Edge::Row(std::max(ya, yb)));
     }
 
-    yMin = std::max(0, yMin);
-    yMax = std::min(fDevice.height(), yMax);
+    yMin = std::max(fClip.top, yMin);
+    yMax = std::min(fClip.bottom, yMax);
 
-    renderEdges(edges, yMin, yMax, paint);
+    renderEdges(edges, edgeCount, yMin, yMax, blitter);
 }
 
-// Add a line segment to the edge list and update bounds
-void MyCanvas::addLineSegment(GPoint p0, GPoint p1, std::vector<Edge>& edges, int& yMin, int& yMax) {
-    fCTM.mapPoints(&p0, &p0, 1);
-    fCTM.mapPoints(&p1, &p1, 1);
+// Curves never flatten into more segments than this, however large they are
+static constexpr int kMaxCurveSegments = 1 << 12;
 
-    Edge edge(p0, p1);
-    if (edge.bottomY() != edge.topY()) {
-        edges.push_back(edge);
-        yMin = std::min(yMin, edge.topY());
-        yMax = std::max(yMax, edge.bottomY());
+// Segments needed to keep a curve of the given degree within tolerance of its flattening
+// (Wang's formula): uniform steps in t stay within degree * (degree - 1) / 8 * secondDiff / n^2
+// of the curve, where secondDiff is the largest second difference of its control points
+static int curve_segment_count(float secondDiff, int degree, float tolerance) {
+    const float n = std::sqrt(degree * (degree - 1) * secondDiff / (8 * tolerance));
+    if (!(n > 1)) {
+        return 1;  // Also for NaN
     }
+    return n < kMaxCurveSegments ? (int)std::ceil(n) : kMaxCurveSegments;
 }
 
-// Flatten a quadratic curve using recursive subdivision
-void MyCanvas::flattenQuadratic(const GPoint pts[3], std::vector<Edge>& edges, float tolerance, int& yMin, int& yMax) {
-    float dx = pts[2].x - pts[0].x;
-    float dy = pts[2].y - pts[0].y;
-    float d1x = pts[1].x - pts[0].x;
-    float d1y = pts[1].y - pts[0].y;
-    float error = std::abs(dx * d1y - dy * d1x) / sqrt(dx * dx + dy * dy);
-    if (error <= tolerance) {
-        addLineSegment(pts[0], pts[2], edges, yMin, yMax);
-    } else {
-        GPoint dst[5];
-        GPath::ChopQuadAt(pts, dst, 0.5f);
-        flattenQuadratic(dst, edges, tolerance, yMin, yMax);
-        flattenQuadratic(dst + 2, edges, tolerance, yMin, yMax);
+// Flatten a quadratic curve, stepping its points with forward differences. The curve is
+// A t^2 + B t + C, so with steps of h the first difference changes by 2 A h^2 each step.
+void MyCanvas::flattenQuadratic(const GPoint pts[3], ArenaVector<GPoint>& segments, float tolerance) {
+    const GPoint A = pts[0] - 2 * pts[1] + pts[2];
+    const GPoint B = 2 * (pts[1] - pts[0]);
+    const int n = curve_segment_count(A.length(), 2, tolerance);
+    const float h = 1.0f / n;
+
+    GPoint p = pts[0];
+    GPoint d1 = A * (h * h) + B * h;
+    const GPoint d2 = A * (2 * h * h);
+
+    const size_t base = segments.size();
+    segments.resize(base + 2 * n);
+    GPoint* out = segments.data() + base;
+    for (int i = 1; i < n; ++i) {
+        *out++ = p;
+        p += d1;
+        d1 += d2;
+        *out++ = p;
     }
+    // End exactly on the last point, whatever error the differences accumulated
+    *out++ = p;
+    *out++ = pts[2];
 }
 
-// Flatten a cubic curve using recursive subdivision
-void MyCanvas::flattenCubic(const GPoint pts[4], std::vector<Edge>& edges, float tolerance, int& yMin, int& yMax) {
-    float dx = pts[3].x - pts[0].x;
-    float dy = pts[3].y - pts[0].y;
-    float d1x = pts[1].x - pts[0].x;
-    float d1y = pts[1].y - pts[0].y;
-    float d2x = pts[2].x - pts[1].x;
-    float d2y = pts[2].y - pts[1].y;
+// Flatten a cubic curve, stepping its points with forward differences. The curve is
+// A t^3 + B t^2 + C t + D, whose third difference is the constant 6 A h^3.
+void MyCanvas::flattenCubic(const GPoint pts[4], ArenaVector<GPoint>& segments, float tolerance) {
+    const GPoint A = (pts[3] - pts[0]) + 3 * (pts[1] - pts[2]);
+    const GPoint B = 3 * (pts[0] - 2 * pts[1] + pts[2]);
+    const GPoint C = 3 * (pts[1] - pts[0]);
+    const float secondDiff = std::max((pts[0] - 2 * pts[1] + pts[2]).length(),
+                                      (pts[1] - 2 * pts[2] + pts[3]).length());
+    const int n = curve_segment_count(secondDiff, 3, tolerance);
+    const float h = 1.0f / n;
+
+    GPoint p = pts[0];
+    GPoint d1 = A * (h * h * h) + B * (h * h) + C * h;
+    GPoint d2 = A * (6 * h * h * h) + B * (2 * h * h);
+    const GPoint d3 = A * (6 * h * h * h);
+
+    const size_t base = segments.size();
+    segments.resize(base + 2 * n);
+    GPoint* out = segments.data() + base;
+    for (int i = 1; i < n; ++i) {
+        *out++ = p;
+        p += d1;
+        d1 += d2;
+        d2 += d3;
+        *out++ = p;
+    }
+    *out++ = p;
+    *out++ = pts[3];
+}
 
-    float error = std::abs(dy * d1x - dx * d1y) + std::abs(dy * d2x - dx * d2y);
-    error /= sqrt(dx * dx + dy * dy);
+// To 16.16, pinned to 2^30 pixels either way (NaN goes left)
+static int64_t to_fixed(double v) {
+    const double limit = 1 << 30;
+    return std::llround((v > -limit ? (v < limit ? v : limit) : -limit) * 65536);
+}
+
+// To the 16.16 an edge holds, pinned below 16K pixels either way so that x plus a step (the sweep
+// takes one past an edge's last row) can't overflow. Edges are kept to the clip's columns, so x
+// stays in range and only the slopes of edges too short to step pin.
+static int pin_fixed(int64_t v) {
+    const int64_t limit = (int64_t(1) << 30) - 1;
+    return (int)std::max(-limit, std::min(v, limit));
+}
+
+// x is sampled at scanline centers, which keeps it on the segment. It steps from the segment's
+// own top scanline however far above firstRow that is, so every clip that draws a scanline of the
+// segment finds the same x there, and drawing it in tiles or in pieces matches drawing it whole.
+MyCanvas::Edge::Edge(const GPoint& pt0, const GPoint& pt1, int firstRow, int lastRow) {
+    GPoint p0 = pt0, p1 = pt1;
+    winding = 1;
+    if (p0.y > p1.y) {
+        std::swap(p0, p1);
+        winding = -1;
+    }
+    const int segmentTop = Row(p0.y);
+    top = std::max(segmentTop, firstRow);
+    bottom = std::min(Row(p1.y), lastRow);
+    x = slope = 0;
+    if (top >= bottom) {
+        return;
+    }
 
-    if (error <= tolerance) {
-        addLineSegment(pts[0], pts[3], edges, yMin, yMax);
+    const double dxdy = ((double)p1.x - p0.x) / ((double)p1.y - p0.y);
+    const int64_t x0 = to_fixed(p0.x + (segmentTop + 0.5 - p0.y) * dxdy);
+    const int64_t dx = to_fixed(dxdy);
+    const int64_t limit = int64_t(1) << 46;
+    if (std::abs(x0) < limit && std::abs(dx) < limit >> 16) {
+        x = pin_fixed(x0 + (int64_t)(top - segmentTop) * dx);
     } else {
-        GPoint dst[7];
-        GPath::ChopCubicAt(pts, dst, 0.5f);
-        flattenCubic(dst, edges, tolerance, yMin, yMax);
-        flattenCubic(dst + 3, edges, tolerance, yMin, yMax);
+        x = pin_fixed(to_fixed(p0.x + (top + 0.5 - p0.y) * dxdy));  // Too far off to step
     }
+    slope = pin_fixed(dx);
 }
 
-// Render edges to fill the path using scanline
-void MyCanvas::renderEdges(std::vector<Edge>& edges, int yMin, int yMax, const GPaint& paint) {
-    for (int y = yMin; y < yMax; ++y) {
-        if (y < 0 || y >= fDevice.height()) continue;
+// Render edges to fill the path using an active edge table. Edges are sorted by their top
+// scanline, enter the table when the sweep reaches them and retire once it passes their bottom.
+// Each active edge steps its X incrementally, and the table is kept in X order with an
+// insertion sort, which is close to linear since the order rarely changes between rows.
+void MyCanvas::renderEdges(Edge edges[], int count, int yMin, int yMax, Blitter& blitter) {
+    if (yMin >= yMax) {
+        return;
+    }
 
-        int winding = 0;
-        int L = 0;
-        std::vector<Edge*> activeEdges;
+    std::sort(edges, edges + count, [](const Edge& e1, const Edge& e2) {
+        return e1.top < e2.top;
+    });
+
+    Edge** activeEdges = fArena.makeArray<Edge*>(count);
+    int activeCount = 0;
+    int nextEdge = 0;
 
-        for (auto& edge : edges) {
-            if (edge.isValid(y)) {
-                activeEdges.push_back(&edge);
+    for (int y = yMin; y < yMax; ++y) {
+        // Retire edges that ended above this scanline, keeping the remaining order
+        int kept = 0;
+        for (int i = 0; i < activeCount; ++i) {
+            if (activeEdges[i]->bottom > y) {
+                activeEdges[kept++] = activeEdges[i];
             }
         }
+        activeCount = kept;
 
-        std::sort(activeEdges.begin(), activeEdges.end(), [y](const Edge* e1, const Edge* e2) {
-            return e1->computeX(y) < e2->computeX(y);
-        });
+        // Insert edges that start on this scanline (they start at the clip's top at the latest)
+        while (nextEdge < count && edges[nextEdge].top <= y) {
+            activeEdges[activeCount++] = &edges[nextEdge++];
+        }
+
+        // Insertion sort by X
+        for (int i = 1; i < activeCount; ++i) {
+            Edge* edge = activeEdges[i];
+            int j = i;
+            while (j > 0 && activeEdges[j - 1]->x > edge->x) {
+                activeEdges[j] = activeEdges[j - 1];
+                --j;
+            }
+            activeEdges[j] = edge;
+        }
 
-        for (size_t i = 0; i < activeEdges.size(); ++i) {
-            int x = GRoundToInt(activeEdges[i]->computeX(y));
+        int winding = 0;
+        int L = 0;
+        for (int i = 0; i < activeCount; ++i) {
+            Edge* edge = activeEdges[i];
+            int x = edge->roundX();
             if (winding == 0) {
                 L = x;
             }
-            winding += activeEdges[i]->windingValue();
+            winding += edge->winding;
 
             if (winding == 0) {
                 int R = x;
-                if (L > R) std::swap(L, R);
-                L = std::max(0, L);
-                R = std::min(fDevice.width(), R);
+                L = std::max(fClip.left, L);
+                R = std::min(fClip.right, R);
 
                 if (L < R) {
-                    blit(L, y, R - L, paint);
+                    blitter.blitH(L, y, R - L);
                 }
             }
+            edge->x += edge->slope;
+        }
+    }
+}
+
+namespace {
+
+// A line segment for coverage accumulation, ordered top to bottom, with x relative to the clip
+struct CoverageLine {
+    float x0, y0, x1, y1;
+    float dxdy;
+    float dir;      // 1 if the segment went down, -1 if it went up
+};
+
+}  // namespace
+
+// Add p0..p1 to lines. The parts left or right of [left, right] become vertical lines on that
+// side, which leaves the coverage of every column inside unchanged.
+static void add_coverage_line(GPoint p0, GPoint p1, float left, float right,
+                              CoverageLine lines[], int& count) {
+    float dir = 1;
+    if (p0.y > p1.y) {
+        std::swap(p0, p1);
+        dir = -1;
+    }
+    if (!(p0.y < p1.y) || !std::isfinite(p0.y) || !std::isfinite(p1.y) ||
+        !std::isfinite(p0.x) || !std::isfinite(p1.x)) {
+        return;  // Horizontal lines don't contribute any area, and non-finite ones can't
+    }
+    auto xAt = [&](float y) { return p0.x + (p1.x - p0.x) * ((y - p0.y) / (p1.y - p0.y)); };
+
+    // Split where the line crosses the sides, so each piece is wholly inside or outside
+    float ys[4];
+    int n = 0;
+    ys[n++] = p0.y;
+    for (float side : {left, right}) {
+        if ((p0.x < side) != (p1.x < side)) {
+            float t = (side - p0.x) / (p1.x - p0.x);
+            ys[n++] = std::clamp(p0.y + (p1.y - p0.y) * t, p0.y, p1.y);
+        }
+    }
+    ys[n++] = p1.y;
+    std::sort(ys + 1, ys + n - 1);
+
+    for (int i = 0; i + 1 < n; ++i) {
+        const float ya = ys[i], yb = ys[i + 1];
+        if (yb - ya < 1e-6f) {
+            continue;  // Too short to move the coverage of any pixel
         }
+        const float xa = std::clamp(xAt(ya), left, right) - left;
+        const float xb = std::clamp(xAt(yb), left, right) - left;
+        lines[count++] = {xa, ya, xb, yb, (xb - xa) / (yb - ya), dir};
     }
 }
 
+// Add the signed area to the right of the line from (x, top) to (xNext, bottom) of one row to
+// acc, where d is the row height it spans times its direction. Each cell gets the area between
+// its left side and the line, less what the cells before it already got, so a running sum
+// along the row gives the coverage of each pixel.
+static void accumulate_line(float acc[], float x, float xNext, float d, int& lo, int& hi) {
+    const float x0 = std::min(x, xNext);
+    const float x1 = std::max(x, xNext);
+    const float x0floor = std::floor(x0);
+    const float x1ceil = std::ceil(x1);
+    const int x0i = (int)x0floor;
+    const int x1i = (int)x1ceil;
+    lo = std::min(lo, x0i);
+    hi = std::max(hi, x1i + 1);
+
+    if (x1i <= x0i + 1) {
+        // Within one pixel: split by where the line's midpoint falls
+        const float xmf = 0.5f * (x + xNext) - x0floor;
+        acc[x0i] += d - d * xmf;
+        acc[x0i + 1] += d * xmf;
+        return;
+    }
+
+    const float s = 1 / (x1 - x0);
+    const float x0f = x0 - x0floor;
+    const float a0 = 0.5f * s * (1 - x0f) * (1 - x0f);
+    const float x1f = x1 - x1ceil + 1;
+    const float am = 0.5f * s * x1f * x1f;
+    acc[x0i] += d * a0;
+    if (x1i == x0i + 2) {
+        acc[x0i + 1] += d * (1 - a0 - am);
+    } else {
+        const float a1 = s * (1.5f - x0f);
+        acc[x0i + 1] += d * (a1 - a0);
+        for (int xi = x0i + 2; xi < x1i - 1; ++xi) {
+            acc[xi] += d * s;
+        }
+        const float a2 = a1 + (x1i - x0i - 3) * s;
+        acc[x1i - 1] += d * (1 - a2 - am);
+    }
+    acc[x1i] += d * am;
+}
+
+// Fill the device-space segments with anti-aliasing, using the nonzero rule. Every row
+// accumulates the signed area each segment leaves to its right, and a running sum then gives
+// the exact fraction of each pixel that is covered (clamped to 1 where contours overlap).
+// Fully covered runs blit normally; partial ones blend with their coverage.
+void MyCanvas::renderCoverage(const GPoint segments[], int count, Blitter& blitter) {
+    const int width = fClip.width();
+    // Each segment splits into at most 3 lines at the sides of the clip
+    CoverageLine* lines = fArena.makeArray<CoverageLine>(count / 2 * 3);
+    int lineCount = 0;
+    for (int i = 0; i + 1 < count; i += 2) {
+        add_coverage_line(segments[i], segments[i + 1], fClip.left, fClip.right, lines, lineCount);
+    }
+    if (lineCount == 0) {
+        return;
+    }
+    float minY = INFINITY, maxY = -INFINITY;
+    for (int i = 0; i < lineCount; ++i) {
+        const CoverageLine& line = lines[i];
+        minY = std::min(minY, line.y0);
+        maxY = std::max(maxY, line.y1);
+    }
+    const int top = (int)std::floor(std::max(minY, (float)fClip.top));
+    const int bottom = (int)std::ceil(std::min(maxY, (float)fClip.bottom));
+    if (top >= bottom) {
+        return;
+    }
+
+    std::sort(lines, lines + lineCount, [](const CoverageLine& a, const CoverageLine& b) {
+        return a.y0 < b.y0;
+    });
+
+    // Two extra columns catch area from lines on (or just right of) the right side
+    fAccumulation.assign(width + 2, 0.0f);
+    fCoverage.resize(width);
+    float* acc = fAccumulation.data();
+    uint8_t* coverage = fCoverage.data();
+
+    const CoverageLine** active = fArena.makeArray<const CoverageLine*>(lineCount);
+    int activeCount = 0;
+    int nextLine = 0;
+    for (int y = top; y < bottom; ++y) {
+        int kept = 0;
+        for (int i = 0; i < activeCount; ++i) {
+            if (active[i]->y1 > y) {
+                active[kept++] = active[i];
+            }
+        }
+        activeCount = kept;
+        while (nextLine < lineCount && lines[nextLine].y0 < y + 1) {
+            const CoverageLine* line = &lines[nextLine++];
+            if (line->y1 > y) {
+                active[activeCount++] = line;
+            }
+        }
+
+        int lo = width + 2, hi = 0;
+        for (int i = 0; i < activeCount; ++i) {
+            const CoverageLine* line = active[i];
+            const float ya = std::max(line->y0, (float)y);
+            const float yb = std::min(line->y1, (float)(y + 1));
+            if (ya < yb) {
+                const float xa = std::clamp(line->x0 + (ya - line->y0) * line->dxdy, 0.0f, (float)width);
+                const float xb = std::clamp(line->x0 + (yb - line->y0) * line->dxdy, 0.0f, (float)width);
+                accumulate_line(acc, xa, xb, (yb - ya) * line->dir, lo, hi);
+            }
+        }
+        if (lo >= hi) {
+            continue;
+        }
+
+        // Resolve the touched columns to coverage, clearing them for the next row
+        hi = std::min(hi, width + 2);
+        const int end = std::min(hi, width);
+        float sum = 0;
+        for (int x = lo; x < end; ++x) {
+            sum += acc[x];
+            acc[x] = 0;
+            coverage[x] = (uint8_t)(std::min(std::abs(sum), 1.0f) * 255 + 0.5f);
+        }
+        std::fill(acc + end, acc + hi, 0.0f);
+
+        // Blit runs of full coverage as spans, and runs of partial coverage with it
+        for (int x = lo; x < end;) {
+            const uint8_t c = coverage[x];
+            int next = x + 1;
+            if (c == 0 || c == 255) {
+                while (next < end && coverage[next] == c) {
+                    ++next;
+                }
+                if (c) {
+                    blitter.blitH(fClip.left + x, y, next - x);
+                }
+            } else {
+                while (next < end && coverage[next] != 0 && coverage[next] != 255) {
+                    ++next;
+                }
+                blitter.blitAntiH(fClip.left + x, y, next - x, coverage + x);
+            }
+            x = next;
+        }
+    }
+}
 
 // Define the GCreateCanvas function to return an instance of MyCanvas
 std::unique_ptr<GCanvas> GCreateCanvas(const GBitmap& bitmap) {
@@ -14,11 +14,19 @@
 #include "proxy_shader.h"
 #include "composite_shader.h"
 #include "bitmap_shader.h"
+#include "blitter.h"
+#include "arena.h"
 #include <stack>
 
 class MyCanvas : public GCanvas {
 public:
-    MyCanvas(const GBitmap& device) : fDevice(device), fCTM(GMatrix()) {}
+    MyCanvas(const GBitmap& device)
+        : MyCanvas(device, GIRect::WH(device.width(), device.height())) {}
+
+    // Canvas that only touches the pixels of device inside clip (e.g. one tile of a larger
+    // render). Drawing is otherwise identical, since coordinates stay in device space.
+    MyCanvas(const GBitmap& device, const GIRect& clip)
+        : fDevice(device), fClip(clip), fCTM(GMatrix()), fDeviceOpaque(device.isOpaque()) {}
 
     void save() override;
     void restore() override;
@@ -32,54 +40,55 @@ public:
     void drawQuad(const GPoint verts[4], const GColor colors[4], const GPoint texs[4],
                           int level, const GPaint&);
 
-    void blit(int x, int y, int width, const GPaint& paint);
     void drawPath(const GPath& path, const GPaint& paint);
 
 private:
     GBitmap fDevice;
+    GIRect fClip;              // Device pixels this canvas may write, within the device bounds
     GMatrix fCTM;
     std::stack<GMatrix> fMatrixStack;
+    bool fDeviceOpaque;        // True while every pixel in the clip is known to have alpha 255
+
+    std::vector<GPoint> fDevicePts;  // Scratch for points mapped to device space, kept to reuse
+    std::vector<float> fAccumulation;  // Anti-aliasing scratch: signed area per column of a row
+    std::vector<uint8_t> fCoverage;    // ... and the coverage it resolves to
+    ShadeScratch fScratch;             // Rows for shading and blending spans a chunk at a time
+    Arena fArena;                      // Temporaries of the current draw, reset when it returns
 
     GBitmap fBitmap;           // Bitmap for texture shaders
     GMatrix fLocalMatrix;      // Local matrix for transformations
 
+    // Packed into 16 bytes, since huge paths have millions of them and the sweep streams them
     class Edge {
     public:
-        GPoint p0, p1;  
-        int winding;    
+        int top;          // Scanlines [top, bottom) covered by this edge
+        int bottom : 30;
+        int winding : 2;  // 1 if the edge goes down, -1 if it goes up
+        int x;            // 16.16 X at the center of the current scanline, stepped each row
+        int slope;        // 16.16 dX/dY
 
-        // Constructor initializes the edge and determines its winding
-        Edge(const GPoint& pt0, const GPoint& pt1) {
-            if (pt0.y < pt1.y) {
-                p0 = pt0;
-                p1 = pt1;
-                winding = 1;
-            } else {
-                p0 = pt1;
-                p1 = pt0;
-                winding = -1;
-            }
-        }
+        // Covers the scanlines whose centers the segment spans, within [firstRow, lastRow)
+        Edge(const GPoint& pt0, const GPoint& pt1, int firstRow, int lastRow);
 
-        int topY() const { return GRoundToInt(p0.y); }
-        int bottomY() const { return GRoundToInt(p1.y); }
+        bool isEmpty() const { return top >= bottom; }
 
-        // Checks if the edge is valid for a given Y value
-        bool isValid(int y) const { return y >= topY() && y < bottomY(); }
+        // The pixel column whose left side is nearest x
+        int roundX() const { return (x + (1 << 15)) >> 16; }
 
-        // Computes the X coordinate at the given Y value
-        float computeX(int y) const {
-            float t = (y - p0.y) / (p1.y - p0.y);
-            return p0.x + t * (p1.x - p0.x);
+        // The scanline whose top is nearest y, pinned within what bottom can hold, far past any
+        // device; NaN goes to the top
+        static int Row(float y) {
+            const float limit = 1 << 28;
+            return GRoundToInt(y > -limit ? (y < limit ? y : limit) : -limit);
         }
-
-        // Returns the winding value
-        int windingValue() const { return winding; }
     };
-    void addLineSegment(GPoint p0, GPoint p1, std::vector<Edge>& edges, int& yMin, int& yMax);
-    void flattenQuadratic(const GPoint pts[3], std::vector<Edge>& edges, float tolerance, int& yMin, int& yMax);
-    void flattenCubic(const GPoint pts[4], std::vector<Edge>& edges, float tolerance, int& yMin, int& yMax);
-    void renderEdges(std::vector<Edge>& edges, int yMin, int yMax, const GPaint& paint);
+    static_assert(sizeof(Edge) == 16, "edges are streamed by the sweep, keep them small");
+    // Paths are flattened into device-space line segments, stored as pairs of points. Curves
+    // are given in device space, so tolerance is in pixels.
+    void flattenQuadratic(const GPoint pts[3], ArenaVector<GPoint>& segments, float tolerance);
+    void flattenCubic(const GPoint pts[4], ArenaVector<GPoint>& segments, float tolerance);
+    void renderEdges(Edge edges[], int count, int yMin, int yMax, Blitter& blitter);
+    void renderCoverage(const GPoint segments[], int count, Blitter& blitter);
 };
 
 #endif
\ No newline at end of file
@@ -1,12 +1,14 @@
 #include "my_utils.h"
 #include "./include/GMath.h"
 
-// Converts GColor to GPixel with premultiplied alpha
+// Converts GColor to GPixel with premultiplied alpha. Components are pinned before
+// premultiplying, so out-of-range colors (e.g. interpolated past a mesh vertex) keep r, g, b <= a
 GPixel GColorToPixel(const GColor& color) {
-    float a = GPinToUnit(color.a) * 255.0f + 0.5f;  
-    float r = GPinToUnit(color.r * color.a) * 255.0f + 0.5f;  
-    float g = GPinToUnit(color.g * color.a) * 255.0f + 0.5f;  
-    float b = GPinToUnit(color.b * color.a) * 255.0f + 0.5f;  
+    const GColor c = color.pinToUnit();
+    float a = c.a * 255.0f + 0.5f;
+    float r = c.r * c.a * 255.0f + 0.5f;
+    float g = c.g * c.a * 255.0f + 0.5f;
+    float b = c.b * c.a * 255.0f + 0.5f;
     return GPixel_PackARGB(static_cast<int>(a), static_cast<int>(r), static_cast<int>(g), static_cast<int>(b));
 }
 
@@ -16,10 +18,10 @@ GPixel BlendPixels(const GPixel& src, const GPixel& dst) {
     int srcA = GPixel_GetA(src);
     int invSrcA = 255 - srcA;
 
-    int a = srcA + invSrcA * GPixel_GetA(dst) / 255;
-    int r = GPixel_GetR(src) + invSrcA * GPixel_GetR(dst) / 255;
-    int g = GPixel_GetG(src) + invSrcA * GPixel_GetG(dst) / 255;
-    int b = GPixel_GetB(src) + invSrcA * GPixel_GetB(dst) / 255;
+    int a = srcA + GDiv255(invSrcA * GPixel_GetA(dst));
+    int r = GPixel_GetR(src) + GDiv255(invSrcA * GPixel_GetR(dst));
+    int g = GPixel_GetG(src) + GDiv255(invSrcA * GPixel_GetG(dst));
+    int b = GPixel_GetB(src) + GDiv255(invSrcA * GPixel_GetB(dst));
 
     return GPixel_PackARGB(a, r, g, b);
 }
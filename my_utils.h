@@ -6,6 +6,36 @@
 #include "./include/GMatrix.h"
 #include "./include/GPoint.h"
 
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+// Exact round(x / 255) for x in [0, 255*255] (e.g. the product of two 8-bit channels),
+// computed as (x + 128) * 257 >> 16 instead of a divide
+static inline unsigned GDiv255(unsigned x) {
+    return ((x + 128) * 257) >> 16;
+}
+
+#if defined(__SSE2__)
+// GDiv255 on each 16-bit lane
+static inline __m128i GDiv255(__m128i x) {
+    return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(128)), _mm_set1_epi16(257));
+}
+#endif
+
+#if defined(__AVX2__)
+static inline __m256i GDiv255(__m256i x) {
+    return _mm256_mulhi_epu16(_mm256_add_epi16(x, _mm256_set1_epi16(128)),
+                              _mm256_set1_epi16(257));
+}
+#endif
+
+// Longest span shaded or blended in one go. Longer spans are processed a chunk at a time, so
+// scratch rows have a fixed size and stay resident in L1.
+static constexpr int kShadeChunk = 256;
+
 // Utility function to convert GColor to GPixel
 GPixel GColorToPixel(const GColor& color);
 
@@ -0,0 +1,100 @@
+#include "path_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+PathCache::Key::Key(const GPath& path, const GMatrix& ctm) : path(&path) {
+    for (int i = 0; i < 4; ++i) {
+        scale[i] = ctm[i];
+    }
+}
+
+bool PathCache::Key::operator==(const Key& other) const {
+    return path == other.path && scale[0] == other.scale[0] && scale[1] == other.scale[1] &&
+           scale[2] == other.scale[2] && scale[3] == other.scale[3];
+}
+
+size_t PathCache::KeyHash::operator()(const Key& key) const {
+    size_t hash = std::hash<const GPath*>()(key.path);
+    for (float f : key.scale) {
+        uint32_t bits;
+        std::memcpy(&bits, &f, sizeof(bits));
+        hash = hash * 31 + bits;
+    }
+    return hash;
+}
+
+// A run ends where the next segment doesn't start at its end, or after kMaxRunPoints points, so
+// its bounds stay tight
+PathCache::Segments::Segments(const GPoint pts[], size_t count) : points(pts, pts + count) {
+    size_t start = 0;
+    GRect bounds = GRect::LTRB(0, 0, 0, 0);
+    for (size_t i = 0; i < count; i += 2) {
+        if (i > start && (i - start >= kMaxRunPoints || !(pts[i] == pts[i - 1]))) {
+            runs.push_back({bounds, i});
+            start = i;
+        }
+        if (i == start) {
+            bounds = GRect::LTRB(pts[i].x, pts[i].y, pts[i].x, pts[i].y);
+        }
+        bounds.left = std::min(bounds.left, pts[i + 1].x);
+        bounds.top = std::min(bounds.top, pts[i + 1].y);
+        bounds.right = std::max(bounds.right, pts[i + 1].x);
+        bounds.bottom = std::max(bounds.bottom, pts[i + 1].y);
+    }
+    if (count > start) {
+        runs.push_back({bounds, count});
+    }
+}
+
+PathCache& PathCache::Get() {
+    static PathCache cache;
+    return cache;
+}
+
+std::shared_ptr<const PathCache::Segments> PathCache::Find(const GPath& path,
+                                                           const GMatrix& ctm) {
+    PathCache& cache = Get();
+    std::lock_guard<std::mutex> lock(cache.fMutex);
+    auto found = cache.fIndex.find(Key(path, ctm));
+    if (found == cache.fIndex.end()) {
+        return nullptr;
+    }
+    auto entry = found->second;
+    if (entry->owner.lock().get() != &path) {
+        cache.evict(entry);  // Its path is gone, and this one only took its address
+        return nullptr;
+    }
+    cache.fEntries.splice(cache.fEntries.begin(), cache.fEntries, entry);
+    return entry->segments;
+}
+
+void PathCache::Add(const GPath& path, const GMatrix& ctm,
+                    std::shared_ptr<const Segments> segments) {
+    std::weak_ptr<const GPath> owner = path.weak_from_this();
+    if (owner.expired() || segments->points.size() > kMaxPoints / 16) {
+        return;
+    }
+
+    PathCache& cache = Get();
+    std::lock_guard<std::mutex> lock(cache.fMutex);
+    const Key key(path, ctm);
+    auto found = cache.fIndex.find(key);
+    if (found != cache.fIndex.end()) {
+        cache.evict(found->second);  // Another thread flattened it too, or its path is gone
+    }
+    while (!cache.fEntries.empty() && (cache.fEntries.size() >= kMaxEntries ||
+                                       cache.fPoints + segments->points.size() > kMaxPoints)) {
+        cache.evict(std::prev(cache.fEntries.end()));
+    }
+
+    cache.fPoints += segments->points.size();
+    cache.fEntries.push_front({key, std::move(owner), std::move(segments)});
+    cache.fIndex.emplace(key, cache.fEntries.begin());
+}
+
+void PathCache::evict(std::list<Entry>::iterator entry) {
+    fPoints -= entry->segments->points.size();
+    fIndex.erase(entry->key);
+    fEntries.erase(entry);
+}
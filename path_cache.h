@@ -0,0 +1,73 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include "./include/GMatrix.h"
+#include "./include/GPath.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Flattenings of recently drawn paths, shared by every canvas (and so by the tiles of a threaded
+// canvas). Each is made under the draw's CTM with its translation left out, so it serves every
+// draw of that path under a matrix with the same scale, rotation and skew: adding the
+// translation to its points gives what mapping the path would. Paths are immutable, so an entry
+// is valid as long as its path lives; entries hold paths weakly and the least recently used go
+// first.
+class PathCache {
+public:
+    // Line segments as pairs of points, as drawPath builds them, split into runs of connected
+    // segments with their bounds, so draws can cull a run at a time
+    struct Segments {
+        struct Run {
+            GRect bounds;
+            size_t end;  // Past its last point; it starts where the run before it ended
+        };
+        std::vector<GPoint> points;
+        std::vector<Run> runs;
+
+        Segments(const GPoint points[], size_t count);
+    };
+
+    // The flattening of path under ctm less its translation, or null if there is none. Paths
+    // that aren't owned by a shared_ptr are never found.
+    static std::shared_ptr<const Segments> Find(const GPath& path, const GMatrix& ctm);
+
+    // Remember segments as the flattening of path under ctm less its translation, unless it would
+    // take more than a sixteenth of the cache
+    static void Add(const GPath& path, const GMatrix& ctm,
+                    std::shared_ptr<const Segments> segments);
+
+private:
+    static constexpr size_t kMaxEntries = 4096;
+    static constexpr size_t kMaxPoints = 1 << 20;  // Over all entries, 8MB of points
+    static constexpr size_t kMaxRunPoints = 32;
+
+    struct Key {
+        const GPath* path;
+        float scale[4];  // ctm[0..3]; the translation is left out
+
+        Key(const GPath& path, const GMatrix& ctm);
+        bool operator==(const Key& other) const;
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+    struct Entry {
+        Key key;
+        std::weak_ptr<const GPath> owner;  // Tells a live path from one reallocated at its address
+        std::shared_ptr<const Segments> segments;
+    };
+
+    static PathCache& Get();
+
+    void evict(std::list<Entry>::iterator entry);
+
+    std::mutex fMutex;
+    std::list<Entry> fEntries;  // Most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> fIndex;
+    size_t fPoints = 0;
+};
+
+#endif
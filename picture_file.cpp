@@ -0,0 +1,520 @@
+#include "picture_file.h"
+#include "bitmap_shader.h"
+#include "linear_gradient_shader.h"
+#include "GFinalCustom.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+
+constexpr uint32_t kMagic = 'G' | 'P' << 8 | 'I' << 16 | 'C' << 24;
+
+// A run of words, offset from the start of the file
+struct Section {
+    uint32_t offset;
+    uint32_t count;
+};
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width, height;  // Canvas the picture was recorded for
+    uint32_t opCount;
+    Section ops;            // Op stream, count = words
+    Section paints;         // PaintRecord[count]
+    Section paths;          // PathRecord[count]
+    Section shaders;        // ShaderRecord[count]
+    Section blobs;          // BlobRecord[count]
+    Section data;           // count = words, referenced by word offset from the records
+};
+
+struct PaintRecord {
+    GColor color;
+    uint32_t mode;
+    int32_t shader;         // -1 for none
+    uint32_t flags;
+};
+
+enum {
+    kAntiAlias_PaintFlag = 1 << 0,
+};
+
+struct PathRecord {
+    uint32_t pointCount, verbCount;
+    uint32_t points, verbs; // GPoint[pointCount], and one byte per verb padded to a word
+};
+
+// Shader payloads in the data section:
+//   kBitmap              blob, tile, filter, GMatrix
+//   kLinearGradient      tile, count, GPoint p0, p1, GColor[count]
+//   kLinearPosGradient   count, GPoint p0, p1, GColor[count], float[count]
+//   kSweepGradient       count, GPoint center, float startRadians, GColor[count]
+//   kColorMatrix         shader, float[20]
+//   kVoronoi             count, GPoint[count], GColor[count]
+// Shaders only refer to shaders before them, so they can be made in order.
+enum class ShaderType : uint32_t {
+    kBitmap,
+    kLinearGradient,
+    kLinearPosGradient,
+    kSweepGradient,
+    kColorMatrix,
+    kVoronoi,
+};
+
+struct ShaderRecord {
+    ShaderType type;
+    uint32_t data;
+};
+
+struct BlobRecord {
+    uint32_t hash[2];       // Content hash of the pixels, low word first
+    int32_t width, height;
+    uint32_t opaque;
+    uint32_t pixels;        // GPixel[width * height], tightly packed
+};
+
+static_assert(sizeof(FileHeader) % sizeof(uint32_t) == 0, "records must pack into words");
+static_assert(sizeof(PaintRecord) % sizeof(uint32_t) == 0, "records must pack into words");
+static_assert(sizeof(PathRecord) % sizeof(uint32_t) == 0, "records must pack into words");
+static_assert(sizeof(ShaderRecord) % sizeof(uint32_t) == 0, "records must pack into words");
+static_assert(sizeof(BlobRecord) % sizeof(uint32_t) == 0, "records must pack into words");
+
+// FNV-1a over the visible pixels, row by row
+uint64_t hash_pixels(const GBitmap& bitmap) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int y = 0; y < bitmap.height(); ++y) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(bitmap.getAddr(0, y));
+        for (size_t i = 0; i < bitmap.width() * sizeof(GPixel); ++i) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+bool same_pixels(const GBitmap& a, const GBitmap& b) {
+    if (a.width() != b.width() || a.height() != b.height()) {
+        return false;
+    }
+    for (int y = 0; y < a.height(); ++y) {
+        if (memcmp(a.getAddr(0, y), b.getAddr(0, y), a.width() * sizeof(GPixel))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Append count values of T as words, returning the word offset they start at
+template <typename T> uint32_t append(std::vector<uint32_t>& dst, const T src[], size_t count) {
+    const size_t offset = dst.size();
+    const size_t bytes = count * sizeof(T);
+    dst.resize(offset + (bytes + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+    memcpy(dst.data() + offset, src, bytes);
+    return (uint32_t)offset;
+}
+
+uint32_t append_int(std::vector<uint32_t>& dst, int value) {
+    return append(dst, &value, 1);
+}
+
+// Bounds-checked reads of word-packed values out of the mapping
+class Reader {
+public:
+    Reader(const uint32_t* begin, const uint32_t* end) : fCurr(begin), fEnd(end) {}
+
+    template <typename T> const T* read(size_t count) {
+        const size_t words = (count * sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+        if (!fCurr || words > (size_t)(fEnd - fCurr)) {
+            fCurr = nullptr;
+            return nullptr;
+        }
+        const T* values = reinterpret_cast<const T*>(fCurr);
+        fCurr += words;
+        return values;
+    }
+
+    int readInt() {
+        const int* value = this->read<int>(1);
+        return value ? *value : -1;
+    }
+
+    bool ok() const { return fCurr != nullptr; }
+
+private:
+    const uint32_t* fCurr;
+    const uint32_t* fEnd;
+};
+
+// The mapped file, plus the objects made from it that the picture doesn't otherwise own
+struct Mapping {
+    void* fAddr = MAP_FAILED;
+    size_t fSize = 0;
+    std::vector<std::shared_ptr<GShader>> fShaders;
+
+    ~Mapping() {
+        fShaders.clear();
+        if (fAddr != MAP_FAILED) {
+            munmap(fAddr, fSize);
+        }
+    }
+};
+
+}  // namespace
+
+class PictureFile {
+public:
+    static bool Write(const GPicture& picture, int width, int height, const char path[]);
+    static std::shared_ptr<const GPicture> Read(const char path[], int* width, int* height);
+
+private:
+    int addShader(GShader* shader);
+    int addBlob(const GBitmap& bitmap);
+    uint32_t addPath(const GPath& path);
+
+    std::vector<PaintRecord> fPaints;
+    std::vector<PathRecord> fPaths;
+    std::vector<ShaderRecord> fShaders;
+    std::vector<BlobRecord> fBlobs;
+    std::vector<uint32_t> fData;
+
+    std::unordered_map<GShader*, int> fShaderIndices;
+    std::unordered_multimap<uint64_t, int> fBlobIndices;
+    std::vector<GBitmap> fBlobBitmaps;
+};
+
+// Returns the index of the shader's record, or -1 if it is not a type the format can hold
+int PictureFile::addShader(GShader* shader) {
+    auto found = fShaderIndices.find(shader);
+    if (found != fShaderIndices.end()) {
+        return found->second;
+    }
+
+    ShaderRecord record;
+    if (auto bitmap = dynamic_cast<BitmapShader*>(shader)) {
+        const int blob = this->addBlob(bitmap->fBitmap);
+        record = {ShaderType::kBitmap, append_int(fData, blob)};
+        append_int(fData, (int)bitmap->fTileMode);
+        append_int(fData, (int)bitmap->fFilter);
+        append(fData, &bitmap->fLocalMatrix, 1);
+    } else if (auto linear = dynamic_cast<LinearGradientShader*>(shader)) {
+        record = {ShaderType::kLinearGradient, append_int(fData, (int)linear->fTileMode)};
+        append_int(fData, linear->fCount);
+        append(fData, &linear->fP0, 1);
+        append(fData, &linear->fP1, 1);
+        append(fData, linear->fColors, linear->fCount);
+    } else if (auto linearPos = dynamic_cast<GLinearPosGradientShader*>(shader)) {
+        record = {ShaderType::kLinearPosGradient, append_int(fData, linearPos->fCount)};
+        append(fData, &linearPos->fP0, 1);
+        append(fData, &linearPos->fP1, 1);
+        append(fData, linearPos->fColors.data(), linearPos->fCount);
+        append(fData, linearPos->fPos.data(), linearPos->fCount);
+    } else if (auto sweep = dynamic_cast<GSweepGradientShader*>(shader)) {
+        record = {ShaderType::kSweepGradient, append_int(fData, sweep->fCount)};
+        append(fData, &sweep->fCenter, 1);
+        append(fData, &sweep->fStartRadians, 1);
+        append(fData, sweep->fColors.data(), sweep->fCount);
+    } else if (auto colorMatrix = dynamic_cast<GColorMatrixShader*>(shader)) {
+        const int child = this->addShader(colorMatrix->fRealShader);
+        if (child < 0) {
+            return -1;
+        }
+        record = {ShaderType::kColorMatrix, append_int(fData, child)};
+        append(fData, colorMatrix->fMatrix.fMat.data(), 20);
+    } else if (auto voronoi = dynamic_cast<GVoronoiShader*>(shader)) {
+        const int count = (int)voronoi->fPoints.size();
+        record = {ShaderType::kVoronoi, append_int(fData, count)};
+        append(fData, voronoi->fPoints.data(), count);
+        append(fData, voronoi->fColors.data(), count);
+    } else {
+        return -1;
+    }
+
+    fShaders.push_back(record);
+    fShaderIndices[shader] = (int)fShaders.size() - 1;
+    return (int)fShaders.size() - 1;
+}
+
+int PictureFile::addBlob(const GBitmap& bitmap) {
+    const uint64_t hash = hash_pixels(bitmap);
+    auto range = fBlobIndices.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (same_pixels(fBlobBitmaps[it->second], bitmap)) {
+            return it->second;
+        }
+    }
+
+    BlobRecord record = {
+        {(uint32_t)hash, (uint32_t)(hash >> 32)},
+        bitmap.width(), bitmap.height(), bitmap.isOpaque(), (uint32_t)fData.size(),
+    };
+    for (int y = 0; y < bitmap.height(); ++y) {
+        append(fData, bitmap.getAddr(0, y), bitmap.width());
+    }
+    fBlobs.push_back(record);
+    fBlobBitmaps.push_back(bitmap);
+    fBlobIndices.emplace(hash, (int)fBlobs.size() - 1);
+    return (int)fBlobs.size() - 1;
+}
+
+uint32_t PictureFile::addPath(const GPath& path) {
+    std::vector<GPoint> points;
+    std::vector<uint8_t> verbs;
+    GPoint pts[GPath::kMaxNextPoints];
+    GPath::Iter iter(path);
+    while (auto v = iter.next(pts)) {
+        const int first = *v == kMove ? 0 : 1;
+        points.insert(points.end(), pts + first, pts + first + (*v == kMove ? 1 : (int)*v));
+        verbs.push_back((uint8_t)*v);
+    }
+
+    PathRecord record = {(uint32_t)points.size(), (uint32_t)verbs.size(), 0, 0};
+    record.points = append(fData, points.data(), points.size());
+    record.verbs = append(fData, verbs.data(), verbs.size());
+    fPaths.push_back(record);
+    return (uint32_t)fPaths.size() - 1;
+}
+
+bool PictureFile::Write(const GPicture& picture, int width, int height, const char path[]) {
+    PictureFile writer;
+    for (const GPaint& paint : picture.fPaints) {
+        int shader = -1;
+        if (paint.peekShader()) {
+            shader = writer.addShader(paint.peekShader());
+            if (shader < 0) {
+                return false;
+            }
+        }
+        const uint32_t flags = paint.isAntiAlias() ? kAntiAlias_PaintFlag : 0;
+        writer.fPaints.push_back({paint.getColor(), (uint32_t)paint.getBlendMode(), shader, flags});
+    }
+    for (const auto& p : picture.fPaths) {
+        writer.addPath(*p);
+    }
+
+    std::vector<uint32_t> file(sizeof(FileHeader) / sizeof(uint32_t));
+    FileHeader header = {kMagic, kPictureFileVersion, width, height, (uint32_t)picture.fOpCount};
+    auto section = [&file](const auto* src, size_t count) {
+        return Section{append(file, src, count), (uint32_t)count};
+    };
+    header.ops = section(picture.fOps, picture.fOpWords);
+    header.paints = section(writer.fPaints.data(), writer.fPaints.size());
+    header.paths = section(writer.fPaths.data(), writer.fPaths.size());
+    header.shaders = section(writer.fShaders.data(), writer.fShaders.size());
+    header.blobs = section(writer.fBlobs.data(), writer.fBlobs.size());
+    header.data = section(writer.fData.data(), writer.fData.size());
+    memcpy(file.data(), &header, sizeof(header));
+
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    const bool wrote = fwrite(file.data(), sizeof(uint32_t), file.size(), f) == file.size();
+    return fclose(f) == 0 && wrote;
+}
+
+std::shared_ptr<const GPicture> PictureFile::Read(const char path[], int* width, int* height) {
+    auto mapping = std::make_shared<Mapping>();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && (size_t)info.st_size >= sizeof(FileHeader)) {
+        mapping->fSize = info.st_size;
+        mapping->fAddr = mmap(nullptr, mapping->fSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping->fAddr == MAP_FAILED) {
+        return nullptr;
+    }
+
+    const uint32_t* base = static_cast<const uint32_t*>(mapping->fAddr);
+    const uint32_t* end = base + mapping->fSize / sizeof(uint32_t);
+    const FileHeader& header = *reinterpret_cast<const FileHeader*>(base);
+    if (header.magic != kMagic || header.version != kPictureFileVersion) {
+        return nullptr;
+    }
+
+    // Each table must lie inside the file; records in it refer into the data section
+    auto table = [&](const Section& s, size_t recordSize) {
+        const size_t fileWords = end - base;
+        const size_t words = s.count * recordSize / sizeof(uint32_t);
+        return s.offset <= fileWords && words <= fileWords - s.offset
+               ? Reader(base + s.offset, base + s.offset + words)
+               : Reader(nullptr, nullptr);
+    };
+    Reader ops = table(header.ops, sizeof(uint32_t));
+    Reader paints = table(header.paints, sizeof(PaintRecord));
+    Reader paths = table(header.paths, sizeof(PathRecord));
+    Reader shaders = table(header.shaders, sizeof(ShaderRecord));
+    Reader blobs = table(header.blobs, sizeof(BlobRecord));
+    if (!table(header.data, sizeof(uint32_t)).ok() || !ops.ok() || !paints.ok() ||
+        !paths.ok() || !shaders.ok() || !blobs.ok()) {
+        return nullptr;
+    }
+    const uint32_t* data = base + header.data.offset;
+    auto dataAt = [&](uint32_t offset) {
+        return offset <= header.data.count ? Reader(data + offset, data + header.data.count)
+                                           : Reader(nullptr, nullptr);
+    };
+
+    // Bitmaps point at their pixels in the mapping
+    std::vector<GBitmap> bitmaps;
+    const BlobRecord* blobRecords = blobs.read<BlobRecord>(header.blobs.count);
+    for (uint32_t i = 0; i < header.blobs.count; ++i) {
+        const BlobRecord& blob = blobRecords[i];
+        if (blob.width <= 0 || blob.height <= 0) {
+            return nullptr;
+        }
+        const GPixel* pixels = dataAt(blob.pixels).read<GPixel>((size_t)blob.width * blob.height);
+        if (!pixels) {
+            return nullptr;
+        }
+        bitmaps.emplace_back(blob.width, blob.height, blob.width * sizeof(GPixel),
+                             const_cast<GPixel*>(pixels), blob.opaque != 0);
+    }
+
+    auto final = GCreateFinal();
+    const ShaderRecord* shaderRecords = shaders.read<ShaderRecord>(header.shaders.count);
+    for (uint32_t i = 0; i < header.shaders.count; ++i) {
+        Reader r = dataAt(shaderRecords[i].data);
+        std::shared_ptr<GShader> shader;
+        switch (shaderRecords[i].type) {
+            case ShaderType::kBitmap: {
+                const int blob = r.readInt();
+                const int tile = r.readInt();
+                const int filter = r.readInt();
+                const GMatrix* matrix = r.read<GMatrix>(1);
+                if (r.ok() && (unsigned)blob < bitmaps.size() &&
+                    (unsigned)tile <= (unsigned)GTileMode::kMirror &&
+                    (unsigned)filter <= (unsigned)GFilterQuality::kMipmap) {
+                    shader = GCreateBitmapShader(bitmaps[blob], *matrix, (GTileMode)tile,
+                                                 (GFilterQuality)filter);
+                }
+            } break;
+            case ShaderType::kLinearGradient: {
+                const int tile = r.readInt();
+                const int count = r.readInt();
+                const GPoint* pts = r.read<GPoint>(2);
+                const GColor* colors = r.read<GColor>(std::max(count, 0));
+                if (r.ok() && count > 0 && (unsigned)tile <= (unsigned)GTileMode::kMirror) {
+                    shader = GCreateLinearGradient(pts[0], pts[1], colors, count, (GTileMode)tile);
+                }
+            } break;
+            case ShaderType::kLinearPosGradient: {
+                const int count = r.readInt();
+                const GPoint* pts = r.read<GPoint>(2);
+                const GColor* colors = r.read<GColor>(std::max(count, 0));
+                const float* pos = r.read<float>(std::max(count, 0));
+                if (r.ok() && count > 0) {
+                    shader = final->createLinearPosGradient(pts[0], pts[1], colors, pos, count);
+                }
+            } break;
+            case ShaderType::kSweepGradient: {
+                const int count = r.readInt();
+                const GPoint* center = r.read<GPoint>(1);
+                const float* startRadians = r.read<float>(1);
+                const GColor* colors = r.read<GColor>(std::max(count, 0));
+                if (r.ok() && count > 0) {
+                    shader = final->createSweepGradient(*center, *startRadians, colors, count);
+                }
+            } break;
+            case ShaderType::kColorMatrix: {
+                const int child = r.readInt();
+                const float* values = r.read<float>(20);
+                if (r.ok() && (unsigned)child < i) {
+                    std::array<float, 20> matrix;
+                    std::copy(values, values + 20, matrix.begin());
+                    shader = final->createColorMatrixShader(GColorMatrix(matrix),
+                                                            mapping->fShaders[child].get());
+                }
+            } break;
+            case ShaderType::kVoronoi: {
+                const int count = r.readInt();
+                const GPoint* points = r.read<GPoint>(std::max(count, 0));
+                const GColor* colors = r.read<GColor>(std::max(count, 0));
+                if (r.ok() && count > 0) {
+                    shader = final->createVoronoiShader(points, colors, count);
+                }
+            } break;
+        }
+        if (!shader) {
+            return nullptr;
+        }
+        mapping->fShaders.push_back(std::move(shader));
+    }
+
+    std::shared_ptr<GPicture> picture(new GPicture);
+    const PaintRecord* paintRecords = paints.read<PaintRecord>(header.paints.count);
+    for (uint32_t i = 0; i < header.paints.count; ++i) {
+        const PaintRecord& record = paintRecords[i];
+        if (record.mode > (uint32_t)GBlendMode::kXor ||
+            (record.shader >= 0 && (uint32_t)record.shader >= header.shaders.count)) {
+            return nullptr;
+        }
+        GPaint paint(record.color);
+        paint.setBlendMode((GBlendMode)record.mode);
+        paint.setAntiAlias(record.flags & kAntiAlias_PaintFlag);
+        if (record.shader >= 0) {
+            paint.setShader(mapping->fShaders[record.shader]);
+        }
+        picture->fPaints.push_back(paint);
+    }
+
+    // GPath keeps its points and verbs in vectors, so each path is copied out once
+    const PathRecord* pathRecords = paths.read<PathRecord>(header.paths.count);
+    for (uint32_t i = 0; i < header.paths.count; ++i) {
+        const PathRecord& record = pathRecords[i];
+        const GPoint* points = dataAt(record.points).read<GPoint>(record.pointCount);
+        const uint8_t* verbs = dataAt(record.verbs).read<uint8_t>(record.verbCount);
+        if (!points || !verbs) {
+            return nullptr;
+        }
+        // Every contour starts with a move, and the verbs account for exactly the points
+        size_t needed = 0;
+        for (uint32_t v = 0; v < record.verbCount; ++v) {
+            if (verbs[v] > kCubic || (v == 0 && verbs[v] != kMove)) {
+                return nullptr;
+            }
+            needed += verbs[v] == kMove ? 1 : verbs[v];
+        }
+        if (needed != record.pointCount) {
+            return nullptr;
+        }
+        std::vector<GPathVerb> pathVerbs(record.verbCount);
+        std::transform(verbs, verbs + record.verbCount, pathVerbs.begin(),
+                       [](uint8_t v) { return (GPathVerb)v; });
+        picture->fPaths.push_back(std::make_shared<GPath>(
+                std::vector<GPoint>(points, points + record.pointCount), std::move(pathVerbs)));
+    }
+
+    picture->fOps = ops.read<uint32_t>(header.ops.count);
+    picture->fOpWords = header.ops.count;
+    picture->fOpCount = (int)header.opCount;
+    if (!picture->validate()) {
+        return nullptr;
+    }
+    picture->fBacking = std::move(mapping);
+
+    if (width) {
+        *width = header.width;
+    }
+    if (height) {
+        *height = header.height;
+    }
+    return picture;
+}
+
+bool GWritePictureFile(const GPicture& picture, int width, int height, const char path[]) {
+    return PictureFile::Write(picture, width, height, path);
+}
+
+std::shared_ptr<const GPicture> GReadPictureFile(const char path[], int* width, int* height) {
+    return PictureFile::Read(path, width, height);
+}
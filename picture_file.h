@@ -0,0 +1,34 @@
+#ifndef PICTURE_FILE_H
+#define PICTURE_FILE_H
+
+#include "GPicture.h"
+#include <memory>
+
+// Binary file format for GPictures, so recorded draw streams can be captured and replayed later.
+//
+// A file is a header followed by word-aligned sections: the op stream exactly as GPicture
+// stores it, then tables of paints, paths, shaders and bitmaps, and the data they refer to.
+// Reading maps the file and replays the ops (and bitmap pixels) straight from the mapping.
+// Each unique paint, path and shader is materialized once when the file is opened.
+//
+// Bitmaps are stored once per unique content hash. Shaders are stored by their parameters, so
+// only the shader types this repo creates (bitmap, linear, linear-pos, sweep, color matrix,
+// Voronoi) can be written. Files use native byte order.
+
+// Bumped whenever the layout changes; files with another version are rejected
+static constexpr uint32_t kPictureFileVersion = 4;
+
+/**
+ *  Write picture to the file at path, along with the size of the canvas it was recorded for.
+ *  Returns false if the file can't be written, or a paint uses a shader the format can't hold.
+ */
+bool GWritePictureFile(const GPicture& picture, int width, int height, const char path[]);
+
+/**
+ *  Map the file at path and return the picture it holds, or null if the file is missing or
+ *  malformed. If width/height are not null, they're set to the size the picture was recorded for.
+ */
+std::shared_ptr<const GPicture> GReadPictureFile(const char path[], int* width = nullptr,
+                                                 int* height = nullptr);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "./include/GShader.h"
 #include "./include/GMatrix.h"
+#include "arena.h"
 #include <memory>
 
 class ProxyShader : public GShader {
@@ -13,16 +14,13 @@ public:
     ProxyShader(std::shared_ptr<GShader> shader, const GMatrix& extraTransform)
         : fRealShader(shader), fExtraTransform(extraTransform) {}
 
-    bool isOpaque() override {
+    bool isOpaque() const override {
         return fRealShader->isOpaque();
     }
 
-    bool setContext(const GMatrix& ctm) override {
-        return fRealShader->setContext(GMatrix::Concat(ctm, fExtraTransform));
-    }
-
-    void shadeRow(int x, int y, int count, GPixel row[]) override {
-        fRealShader->shadeRow(x, y, count, row);
+    // The real shader's context does all the work, it just sees an extra transform
+    GShaderContext* makeContext(const GMatrix& ctm, Arena& arena) const override {
+        return fRealShader->makeContext(GMatrix::Concat(ctm, fExtraTransform), arena);
     }
 };
 
@@ -0,0 +1,197 @@
+#include "threaded_canvas.h"
+#include "my_canvas.h"
+
+// Device-space bounds of pts after mapping them by ctm
+static GRect map_bounds(const GMatrix& ctm, const GPoint pts[], int count) {
+    GRect bounds = GRect::LTRB(INFINITY, INFINITY, -INFINITY, -INFINITY);
+    for (int i = 0; i < count; ++i) {
+        GPoint p = ctm * pts[i];
+        bounds.left = std::min(bounds.left, p.x);
+        bounds.top = std::min(bounds.top, p.y);
+        bounds.right = std::max(bounds.right, p.x);
+        bounds.bottom = std::max(bounds.bottom, p.y);
+    }
+    return bounds;
+}
+
+static GRect map_rect_bounds(const GMatrix& ctm, const GRect& r) {
+    const GPoint corners[4] = {
+        {r.left, r.top}, {r.right, r.top}, {r.right, r.bottom}, {r.left, r.bottom},
+    };
+    return map_bounds(ctm, corners, 4);
+}
+
+ThreadedCanvas::ThreadedCanvas(const GBitmap& device, int threads)
+    : fDevice(device), fThreads(threads) {
+    if (fThreads <= 0) {
+        fThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    fTilesX = (device.width() + kTileSize - 1) / kTileSize;
+    fTilesY = (device.height() + kTileSize - 1) / kTileSize;
+    fTileDraws.resize(fTilesX * fTilesY);
+
+    // The calling thread is one of the fThreads
+    const int workers = std::min(fThreads, fTilesX * fTilesY) - 1;
+    for (int i = 0; i < workers; ++i) {
+        fWorkers.emplace_back([this]() { this->workerLoop(); });
+    }
+}
+
+ThreadedCanvas::~ThreadedCanvas() {
+    this->flush();
+
+    {
+        std::lock_guard<std::mutex> lock(fPoolMutex);
+        fStopping = true;
+    }
+    fWorkReady.notify_all();
+    for (auto& worker : fWorkers) {
+        worker.join();
+    }
+}
+
+// Workers sleep between flushes, and wake when flush() bumps fFlushCount
+void ThreadedCanvas::workerLoop() {
+    uint64_t flushesDone = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(fPoolMutex);
+            fWorkReady.wait(lock, [&]() { return fStopping || fFlushCount != flushesDone; });
+            if (fStopping) {
+                return;
+            }
+            flushesDone = fFlushCount;
+        }
+
+        this->drawTiles();
+
+        std::lock_guard<std::mutex> lock(fPoolMutex);
+        if (--fBusyWorkers == 0) {
+            fWorkDone.notify_one();
+        }
+    }
+}
+
+// Threads pull tiles off a shared counter until none are left
+void ThreadedCanvas::drawTiles() {
+    const int tileCount = fTilesX * fTilesY;
+    for (int tile = fNextTile++; tile < tileCount; tile = fNextTile++) {
+        this->drawTile(*fPicture, tile);
+    }
+}
+
+// Remember where the draw is and the CTM it needs, and add it to every tile its bounds overlap.
+// The bounds are outset by a pixel so that rounding at the edges of the geometry can never
+// reach outside the binned tiles, and pinned to the device first so huge (or NaN) coordinates
+// can't overflow the int conversion.
+void ThreadedCanvas::bin(size_t offset, const GRect& deviceBounds) {
+    const float width = (float)fDevice.width();
+    const float height = (float)fDevice.height();
+    GIRect bounds = GIRect::LTRB(
+            std::max(GFloorToInt(std::max(0.0f, deviceBounds.left)) - 1, 0),
+            std::max(GFloorToInt(std::max(0.0f, deviceBounds.top)) - 1, 0),
+            std::min(GCeilToInt(std::min(width, deviceBounds.right)) + 1, fDevice.width()),
+            std::min(GCeilToInt(std::min(height, deviceBounds.bottom)) + 1, fDevice.height()));
+    if (bounds.isEmpty()) {
+        return;
+    }
+
+    int index = (int)fDraws.size();
+    fDraws.push_back({offset, fCTM});
+    for (int ty = bounds.top / kTileSize; ty <= (bounds.bottom - 1) / kTileSize; ++ty) {
+        for (int tx = bounds.left / kTileSize; tx <= (bounds.right - 1) / kTileSize; ++tx) {
+            fTileDraws[ty * fTilesX + tx].push_back(index);
+        }
+    }
+}
+
+void ThreadedCanvas::flush() {
+    std::shared_ptr<const GPicture> picture = this->finishRecording();
+
+    // Apply the state ops here, so each draw can be replayed on its own with its CTM
+    GPicture::Iter iter(*picture);
+    GPicture::Op op;
+    for (size_t offset = iter.offset(); iter.next(&op); offset = iter.offset()) {
+        switch (op.type) {
+            case GPicture::OpType::kSave:
+                fMatrixStack.push(fCTM);
+                break;
+            case GPicture::OpType::kRestore:
+                if (!fMatrixStack.empty()) {
+                    fCTM = fMatrixStack.top();
+                    fMatrixStack.pop();
+                }
+                break;
+            case GPicture::OpType::kConcat:
+                fCTM = GMatrix::Concat(fCTM, *op.matrix);
+                break;
+            case GPicture::OpType::kClear:
+                this->bin(offset, GRect::WH(fDevice.width(), fDevice.height()));
+                break;
+            case GPicture::OpType::kDrawRect:
+                this->bin(offset, map_rect_bounds(fCTM, *op.rect));
+                break;
+            case GPicture::OpType::kDrawPath:
+                this->bin(offset, map_rect_bounds(fCTM, op.path->bounds()));
+                break;
+            case GPicture::OpType::kDrawPolygon:
+            case GPicture::OpType::kDrawMesh:
+            case GPicture::OpType::kDrawQuad:
+                this->bin(offset, map_bounds(fCTM, op.points, op.vertCount));
+                break;
+        }
+    }
+    if (fDraws.empty()) {
+        return;
+    }
+
+    // Hand the tiles to the workers, and help draw them
+    fPicture = picture.get();
+    fNextTile = 0;
+    {
+        std::lock_guard<std::mutex> lock(fPoolMutex);
+        fBusyWorkers = (int)fWorkers.size();
+        fFlushCount += 1;
+    }
+    fWorkReady.notify_all();
+    this->drawTiles();
+    {
+        std::unique_lock<std::mutex> lock(fPoolMutex);
+        fWorkDone.wait(lock, [&]() { return fBusyWorkers == 0; });
+    }
+    fPicture = nullptr;
+
+    fDraws.clear();
+    for (auto& draws : fTileDraws) {
+        draws.clear();
+    }
+}
+
+// Replay the tile's draws. The tile canvas starts with an identity CTM, so concatenating the
+// recorded CTM reproduces it exactly.
+void ThreadedCanvas::drawTile(const GPicture& picture, int tile) {
+    const std::vector<int>& draws = fTileDraws[tile];
+    if (draws.empty()) {
+        return;
+    }
+
+    int left = (tile % fTilesX) * kTileSize;
+    int top = (tile / fTilesX) * kTileSize;
+    GIRect clip = GIRect::LTRB(left, top, std::min(left + kTileSize, fDevice.width()),
+                               std::min(top + kTileSize, fDevice.height()));
+    MyCanvas canvas(fDevice, clip);
+    for (int index : draws) {
+        const Draw& draw = fDraws[index];
+        GPicture::Op op;
+        GPicture::Iter(picture, draw.offset).next(&op);
+
+        canvas.save();
+        canvas.concat(draw.ctm);
+        GPicture::Draw(&canvas, op);
+        canvas.restore();
+    }
+}
+
+std::unique_ptr<ThreadedCanvas> GCreateThreadedCanvas(const GBitmap& bitmap, int threads) {
+    return std::make_unique<ThreadedCanvas>(bitmap, threads);
+}
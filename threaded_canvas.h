@@ -0,0 +1,71 @@
+#ifndef THREADED_CANVAS_H
+#define THREADED_CANVAS_H
+
+#include "GPicture.h"
+#include "./include/GBitmap.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stack>
+#include <thread>
+#include <vector>
+
+// Canvas that records draw calls into a GPicture and rasterizes them on several threads. At
+// flush() each draw is binned by its device bounds into fixed-size tiles, and the tiles are
+// drawn in parallel by MyCanvas instances clipped to them, so draw order is preserved within
+// every tile and the result is identical to drawing on a single MyCanvas.
+//
+// Recorded ops are only guaranteed to be in the bitmap after flush() (which the destructor
+// calls). Paths and shaders are referenced, not copied, and must stay unchanged until then.
+class ThreadedCanvas : public GRecordingCanvas {
+public:
+    static constexpr int kTileSize = 64;
+
+    ThreadedCanvas(const GBitmap& device, int threads);
+    ~ThreadedCanvas() override;
+
+    // Rasterize every op recorded so far into the bitmap
+    void flush();
+
+private:
+    struct Draw {
+        size_t offset;      // Where the op is in the picture
+        GMatrix ctm;        // CTM in effect when it was recorded
+    };
+
+    void bin(size_t offset, const GRect& deviceBounds);
+    void workerLoop();
+    void drawTiles();
+    void drawTile(const GPicture& picture, int tile);
+
+    GBitmap fDevice;
+    int fThreads;
+    int fTilesX, fTilesY;
+
+    // The canvas state carries over from one flush to the next
+    GMatrix fCTM;
+    std::stack<GMatrix> fMatrixStack;
+
+    std::vector<Draw> fDraws;
+    std::vector<std::vector<int>> fTileDraws;  // Draw indices per tile, in draw order
+
+    // Worker threads live as long as the canvas, so flushing doesn't start any. Each flush
+    // publishes the picture and resets the tile counter, then wakes them.
+    std::vector<std::thread> fWorkers;
+    std::mutex fPoolMutex;
+    std::condition_variable fWorkReady;
+    std::condition_variable fWorkDone;
+    uint64_t fFlushCount = 0;      // Flushes handed to the workers so far
+    int fBusyWorkers = 0;          // Workers still drawing the current flush
+    bool fStopping = false;
+    const GPicture* fPicture = nullptr;
+    std::atomic<int> fNextTile{0};
+};
+
+/**
+ *  Return a canvas that draws into bitmap using the given number of threads (or one per
+ *  hardware thread if threads <= 0). Drawing is deferred until flush() or destruction.
+ */
+std::unique_ptr<ThreadedCanvas> GCreateThreadedCanvas(const GBitmap& bitmap, int threads);
+
+#endif